@@ -3,13 +3,15 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE    := gpgoap
-LOCAL_SRC_FILES := astar.c goap.c
+LOCAL_SRC_FILES := astar.c batch.c domain.c goap.c plancache.c policy.c replan.c
 
 #LOCAL_C_INCLUDES := 
 LOCAL_ARM_NEON := true
 LOCAL_ARM_MODE := arm
 
 LOCAL_CFLAGS += -std=c99
+# For more than 64 atoms, use 2, 4 or 8 words per world state:
+#LOCAL_EXPORT_CFLAGS += -DGOAP_WORDS=4
 
 include $(BUILD_STATIC_LIBRARY)
 
@@ -8,80 +8,448 @@ http://www.apache.org/licenses/LICENSE-2.0
 Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
 */
 
+#if !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE )
+#define _POSIX_C_SOURCE 199309L	// for clock_gettime()
+#endif
+
 #include "astar.h"
 #include "goap.h"
+#include "atomics.h"
+
+#include <string.h>
+#include <stdlib.h>
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#endif
+
+
+static astarcontext_t defaultctx;	//!< The context used by astar_plan(), for callers that do not bring their own.
 
-#include <limits.h>
 
+#define H_INF 0x3fffffff	//!< Heuristic for a state from which the goal cannot be reached, even when actions never undo anything.
 
-#define MAXOPEN	1024	//!< The maximum number of nodes we can store in the opened set.
-#define MAXCLOS 1024	//!< The maximum number of nodes we can store in the closed set.
 
+//!< Internal function to compute, for each literal (atom index times two, plus its value), how much it costs to make it true, starting from the specified values.
+//!< This is the relaxed problem, in which actions only add their effects and never undo anything. The cost of a set of literals is their max (h_max) or sum (h_add).
+//!< Only the actions that the search may use count, at the costs that it uses.
+static void relaxed_costs( const astarcontext_t* ctx, bfield_t values, bool additive, int* litcost )
+{
+	actionplanner_t const* ap = ctx->ap;
+	for ( int i=0; i<ap->numatoms; ++i )
+	{
+		const int v = bfield_get( values, i );
+		litcost[ 2*i + v ] = 0;
+		litcost[ 2*i + !v ] = H_INF;
+	}
+	const actiontable_t* t = &ap->act_table;
+	bool changed = true;
+	while ( changed )
+	{
+		changed = false;
+		for ( int a=0; a<t->numactions; ++a )
+		{
+			if ( !( ( ctx->enabled >> a ) & 1 ) ) continue;
+			int cost = 0;
+			for ( int w=0; w<GOAP_WORDS && cost<H_INF; ++w )
+				for ( uint64_t bits=t->pre_care[ w ][ a ]; bits && cost<H_INF; bits&=bits-1 )
+				{
+					const int b = bfield_ctz64( bits );
+					const int c = litcost[ 2*( 64*w + b ) + (int)( ( t->pre_values[ w ][ a ] >> b ) & 1 ) ];
+					cost = c >= H_INF ? H_INF : additive ? cost + c : ( c > cost ? c : cost );
+				}
+			if ( cost >= H_INF ) continue;
+			cost += ctx->costs[ a ];
+			for ( int w=0; w<GOAP_WORDS; ++w )
+				for ( uint64_t bits=t->pst_care[ w ][ a ]; bits; bits&=bits-1 )
+				{
+					const int b = bfield_ctz64( bits );
+					int* c = litcost + 2*( 64*w + b ) + (int)( ( t->pst_values[ w ][ a ] >> b ) & 1 );
+					if ( cost < *c ) { *c = cost; changed = true; }
+				}
+		}
+	}
+}
 
-static astarnode_t opened[ MAXOPEN ];	//!< The set of nodes we should consider.
-static astarnode_t closed[ MAXCLOS ];	//!< The set of nodes we already visited.
 
-static int numOpened = 0;	//!< The nr of nodes in our opened set.
-static int numClosed = 0;	//!< The nr of nodes in our closed set.
+//!< Internal function to combine the relaxed costs of the literals that a (partial) world state asks for.
+static int relaxed_h( const int* litcost, worldstate_t ws, bool additive )
+{
+	int h = 0;
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		for ( uint64_t bits=~bfield_word( ws.dontcare, w ); bits; bits&=bits-1 )
+		{
+			const int b = bfield_ctz64( bits );
+			const int c = litcost[ 2*( 64*w + b ) + (int)( ( bfield_word( ws.values, w ) >> b ) & 1 ) ];
+			if ( c >= H_INF ) return H_INF;
+			h = additive ? h + c : ( c > h ? c : h );
+		}
+	return h;
+}
 
 
-//!< This is our heuristic: estimate for remaining distance is the nr of mismatched atoms that matter.
-static int calc_h( worldstate_t fr, worldstate_t to )
+//!< This is our heuristic: estimate for remaining distance from fr to the goal to, as selected in the context.
+//!< The relaxed heuristics look at fr.values only, so fr can be the start state for every node of a regression search, with the literal costs computed once.
+static int calc_h( const astarcontext_t* ctx, worldstate_t fr, worldstate_t to, const int* litcost )
 {
-	const bfield_t care = ( to.dontcare ^ -1LL );
-	const bfield_t diff = ( ( fr.values & care ) ^ ( to.values & care ) );
-	int dist=0;
-	for ( int i=0; i<MAXATOMS; ++i )
-		if ( ( diff & ( 1LL << i ) ) != 0 ) dist++;
-	return dist;
+	if ( ctx->heuristic == ASTAR_H_MISMATCH )
+		return bfield_mismatch( fr.values, to.values, to.dontcare );
+	const bool additive = ctx->heuristic == ASTAR_H_ADD;
+	if ( litcost )
+		return relaxed_h( litcost, to, additive );
+	int costs[ 2*MAXATOMS ];
+	relaxed_costs( ctx, fr.values, additive, costs );
+	return relaxed_h( costs, to, additive );
 }
 
 
-//!< Internal function to look up a world state in our opened set.
-static int idx_in_opened( worldstate_t ws )
+//!< Internal function to rank a node on its cost so far and its heuristic, weighted by 1+epsilon.
+static int calc_f( const astarcontext_t* ctx, int g, int h )
 {
-	for ( int i=0; i<numOpened; ++i )
-		if ( opened[ i ].ws.values == ws.values ) return i;
-	return -1;
+	if ( ctx->epsilon <= 0.0f ) return g + h;
+	const float f = g + ( 1.0f + ctx->epsilon ) * h;
+	return f < (float)H_INF ? (int)f : H_INF;
 }
 
 
-//!< Internal function to lookup a world state in our closed set.
-static int idx_in_closed( worldstate_t ws )
+//!< Internal function to compare the world states of two nodes. Partial states (in a regression search) also differ in the atoms that do not matter.
+static bool same_node_ws( const astarcontext_t* ctx, worldstate_t a, worldstate_t b )
 {
-	for ( int i=0; i<numClosed; ++i )
-		if ( closed[ i ].ws.values == ws.values ) return i;
-	return -1;
+	return bfield_equal( a.values, b.values ) && ( !ctx->partial || bfield_equal( a.dontcare, b.dontcare ) );
 }
 
 
-//!< Internal function to reconstruct the plan by tracing from last node to initial node.
-static void reconstruct_plan( astarnode_t* goalnode, const char** plan, worldstate_t* worldstates, int* plansize )
+//!< Internal function to find the index slot for a world state. The slot holds the node for that state, or is empty (-1) if we have no such node yet.
+static int* slot_in_nodehash( astarcontext_t* ctx, worldstate_t ws )
 {
-	astarnode_t* curnode = goalnode;
-	int idx = *plansize - 1;
-	int numsteps=0;
-	while ( curnode && curnode->actionname )
+	const uint64_t mask = ctx->hashSize - 1;
+	uint64_t h = bfield_hash( ws.values ) & mask;
+	while ( true )
 	{
-		if ( idx >= 0 )
-		{
-			plan[ idx ] = curnode->actionname;
-			worldstates[ idx ] = curnode->ws;
-			const int i = idx_in_closed( curnode->parentws );
-			curnode = ( i == -1 ) ? 0 : closed+i;
-		}
-		--idx;
-		numsteps++;
+		int* slot = ctx->nodehash + h;
+		if ( *slot == -1 || same_node_ws( ctx, ctx->nodews[ *slot ], ws ) ) return slot;
+		h = ( h + 1 ) & mask;
+	}
+}
+
+
+//!< Internal function to compute how many bytes of storage a search with the given nr of nodes needs.
+static size_t storage_size( int maxnodes, int* hashsize )
+{
+	int sz = 2 * ASTAR_CHUNK;
+	while ( sz < 2 * maxnodes ) sz *= 2;
+	if ( hashsize ) *hashsize = sz;
+	return (size_t)maxnodes * ASTAR_NODE_BYTES + (size_t)sz * sizeof( int );
+}
+
+
+//!< Internal function to grow one of the node arrays. Returns false if out of memory, leaving the array as it was.
+static bool grow_array( void** array, size_t size )
+{
+	void* grown = realloc( *array, size );
+	if ( !grown ) return false;
+	*array = grown;
+	return true;
+}
+
+
+//!< Internal function to make sure there is room for one more node, within the budget. Returns false if the budget does not allow it.
+static bool reserve_node( astarcontext_t* ctx )
+{
+	if ( ctx->numNodes % ASTAR_CHUNK ) return true;	// storage only grows in whole chunks.
+	const int maxnodes = ctx->numNodes + ASTAR_CHUNK;
+	const size_t budget = ctx->budget ? ctx->budget : ASTAR_DEFAULT_BUDGET;
+	int hashsize;
+	if ( storage_size( maxnodes, &hashsize ) > budget ) return false;
+	if ( maxnodes <= ctx->maxNodes ) return true;	// kept from an earlier search.
+
+	const size_t n = maxnodes;
+	if ( !grow_array( (void**) &ctx->nodews, n * sizeof( worldstate_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->nodeparent, n * sizeof( int32_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->nodeaction, n * sizeof( int16_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->nodeg, n * sizeof( int32_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->nodeh, n * sizeof( int32_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->nodeheapidx, n * sizeof( int32_t ) ) ) return false;
+	if ( !grow_array( (void**) &ctx->opened, n * sizeof( astaropen_t ) ) ) return false;
+	if ( hashsize > ctx->hashSize )
+	{
+		if ( !grow_array( (void**) &ctx->nodehash, hashsize * sizeof( int ) ) ) return false;
+		ctx->hashSize = hashsize;
+		// re-index the nodes we have, in the order they were added.
+		memset( ctx->nodehash, 0xff, hashsize * sizeof( int ) );
+		for ( int i=0; i<ctx->numNodes; ++i )
+			*slot_in_nodehash( ctx, ctx->nodews[ i ] ) = i;
+	}
+	ctx->maxNodes = maxnodes;
+	return true;
+}
+
+
+//!< Internal function to empty node storage and its index before a new search.
+static void clear_nodes( astarcontext_t* ctx )
+{
+	// Remove from the index in reverse order of addition: probing for a node then only passes over older nodes, which are still indexed.
+	for ( int i=ctx->numNodes-1; i>=0; --i )
+		*slot_in_nodehash( ctx, ctx->nodews[ i ] ) = -1;
+	ctx->numNodes = 0;
+	ctx->numOpened = 0;
+	ctx->numClosed = 0;
+	ctx->partial = false;
+	ctx->status = ASTAR_NOPATH;
+	ctx->goalidx = -1;
+	ctx->bestidx = 0;
+	memset( &ctx->stats, 0, sizeof( astarstats_t ) );
+}
+
+
+#define MEET_INDEX_COUNT 16	//!< The nr of backward nodes of a bidirectional search that share a dontcare mask before it is worth indexing the forward nodes for it.
+
+
+//!< A dontcare mask of the backward nodes of a bidirectional search, and the nodes that have it.
+typedef struct
+{
+	bfield_t dontcare;	//!< The mask.
+	bfield_t values;	//!< The values of the first backward node in the list.
+	int first;		//!< The first of the backward nodes with the mask, the others follow in the next array.
+	int count;		//!< The nr of backward nodes with the mask.
+	int g;			//!< The lowest cost of the backward nodes with the mask, so that most groups are passed over without looking at their nodes.
+} meetmask_t;
+
+
+//!< A slot in the index where the halves of a bidirectional search meet: a dontcare mask and the values of the atoms it cares about.
+typedef struct
+{
+	bfield_t values;	//!< The values, cleared on the atoms that the mask does not care about.
+	unsigned int generation;	//!< The search that claimed the slot. Slots of earlier searches are empty.
+	int mask;		//!< The position of the mask.
+	int fwdidx;		//!< The cheapest forward node whose state has these values, -1 if there is none yet.
+	int bwdidx;		//!< The backward node with this mask and these values, -1 if there is none yet.
+} meetslot_t;
+
+
+//!< Where the halves of a bidirectional search find each other. A full state can satisfy partial states with any mix of atoms that do not matter,
+//!< so the backward nodes are grouped by their dontcare mask, and a forward node is tested against each group rather than each node.
+//!< Once a mask is shared by MEET_INDEX_COUNT backward nodes, they are indexed on the values of the atoms that the mask cares about, and so are
+//!< the forward nodes, keeping the cheapest one per values. A forward node then needs one probe for the group, and a backward node of the group one probe.
+//!< Smaller groups are tested node by node, as a compare costs less than a probe, and indexing all forward nodes for them would cost more than it saves.
+struct astarmeet
+{
+	meetmask_t* masks;	//!< The distinct dontcare masks of the backward nodes.
+	int numMasks;		//!< The nr of masks.
+	int maxMasks;		//!< The nr of masks that storage has room for.
+	int* maskhash;		//!< Open addressing index that maps a mask onto its position in masks, -1 for empty slots. Twice maxMasks in size.
+	int* next;		//!< For each backward node, the next backward node with the same mask, -1 for the last one.
+	int* group;		//!< For each backward node, the position of its mask.
+	int maxGroup;		//!< The nr of backward nodes that next and group have room for.
+	meetslot_t* slots;	//!< Open addressing index of masks and values.
+	unsigned int generation;	//!< Incremented for each search, which empties all slots at once.
+	int numSlots;		//!< The nr of slots in use.
+	int slotsSize;		//!< The nr of slots, a power of two and at least twice numSlots.
+};
+
+
+void astar_context_init( astarcontext_t* ctx )
+{
+	memset( ctx, 0, sizeof( astarcontext_t ) );
+}
+
+
+void astar_context_release( astarcontext_t* ctx )
+{
+	free( ctx->nodews );
+	free( ctx->nodeparent );
+	free( ctx->nodeaction );
+	free( ctx->nodeg );
+	free( ctx->nodeh );
+	free( ctx->nodeheapidx );
+	free( ctx->nodehash );
+	free( ctx->opened );
+	if ( ctx->reverse )
+	{
+		astar_context_release( ctx->reverse );
+		free( ctx->reverse );
+	}
+	if ( ctx->meet )
+	{
+		free( ctx->meet->masks );
+		free( ctx->meet->maskhash );
+		free( ctx->meet->next );
+		free( ctx->meet->group );
+		free( ctx->meet->slots );
+		free( ctx->meet );
+	}
+	const size_t budget = ctx->budget;
+	astar_context_init( ctx );
+	ctx->budget = budget;
+}
+
+
+//!< Internal function that decides which of two opened entries ranks lower. Ties on f go to the node closest to the goal, so that we search deep first.
+static bool ranks_lower( astaropen_t a, astaropen_t b )
+{
+	return a.f < b.f || ( a.f == b.f && a.h < b.h );
+}
+
+
+//!< Internal function that decides which of two nodes is closer to the goal, for partial plans. Ties on h go to the cheaper node.
+static bool ranks_closer( const astarcontext_t* ctx, int a, int b )
+{
+	return ctx->nodeh[ a ] < ctx->nodeh[ b ] || ( ctx->nodeh[ a ] == ctx->nodeh[ b ] && ctx->nodeg[ a ] < ctx->nodeg[ b ] );
+}
+
+
+//!< Internal function to move an opened entry up the heap, after it was added or its rank decreased.
+static void heap_up( astarcontext_t* ctx, int pos )
+{
+	astaropen_t* opened = ctx->opened;
+	const astaropen_t entry = opened[ pos ];
+	while ( pos > 0 )
+	{
+		const int parent = ( pos - 1 ) / 2;
+		if ( !ranks_lower( entry, opened[ parent ] ) ) break;
+		opened[ pos ] = opened[ parent ];
+		ctx->nodeheapidx[ opened[ pos ].node ] = pos;
+		pos = parent;
+	}
+	opened[ pos ] = entry;
+	ctx->nodeheapidx[ entry.node ] = pos;
+}
+
+
+//!< Internal function to move an opened entry down the heap, after the top was removed.
+static void heap_down( astarcontext_t* ctx, int pos )
+{
+	astaropen_t* opened = ctx->opened;
+	const astaropen_t entry = opened[ pos ];
+	while ( true )
+	{
+		int child = 2 * pos + 1;
+		if ( child >= ctx->numOpened ) break;
+		if ( child+1 < ctx->numOpened && ranks_lower( opened[ child+1 ], opened[ child ] ) ) child++;
+		if ( !ranks_lower( opened[ child ], entry ) ) break;
+		opened[ pos ] = opened[ child ];
+		ctx->nodeheapidx[ opened[ pos ].node ] = pos;
+		pos = child;
+	}
+	opened[ pos ] = entry;
+	ctx->nodeheapidx[ entry.node ] = pos;
+}
+
+
+//!< Internal function to add a stored node to the opened set.
+static void heap_push( astarcontext_t* ctx, int nodeidx )
+{
+	astaropen_t* entry = ctx->opened + ctx->numOpened;
+	entry->f = calc_f( ctx, ctx->nodeg[ nodeidx ], ctx->nodeh[ nodeidx ] );
+	entry->h = ctx->nodeh[ nodeidx ];
+	entry->node = nodeidx;
+	heap_up( ctx, ctx->numOpened++ );
+	if ( ctx->numOpened > ctx->stats.peakOpened ) ctx->stats.peakOpened = ctx->numOpened;
+}
+
+
+//!< Internal function to remove the lowest ranked node from the opened set.
+static int heap_pop( astarcontext_t* ctx )
+{
+	const int top = ctx->opened[ 0 ].node;
+	ctx->nodeheapidx[ top ] = -1;
+	if ( --ctx->numOpened > 0 )
+	{
+		ctx->opened[ 0 ] = ctx->opened[ ctx->numOpened ];
+		heap_down( ctx, 0 );
+	}
+	return top;
+}
+
+
+//!< Internal function to report a search event to the trace function, if there is one.
+static inline void trace( astarcontext_t* ctx, int event, int nodeidx )
+{
+	if ( ctx->trace ) ctx->trace( event, ctx, nodeidx, ctx->traceuser );
+}
+
+
+//!< Internal function to count the expansion of a node, which moves it to the closed set.
+static void note_expansion( astarcontext_t* ctx, int nodeidx )
+{
+	ctx->stats.expanded++;
+	if ( ++ctx->numClosed > ctx->stats.peakClosed ) ctx->stats.peakClosed = ctx->numClosed;
+	trace( ctx, ASTAR_TRACE_EXPAND, nodeidx );
+}
+
+
+//!< Internal function to add the time spent in a search step to the statistics.
+static void note_time( astarcontext_t* ctx, int64_t t0, int64_t t1 )
+{
+	ctx->stats.microseconds += t1 - t0;
+	ctx->stats.successorsPerExpansion = ctx->stats.expanded ? (float)ctx->stats.successors / ctx->stats.expanded : 0.0f;
+}
+
+
+//!< Internal function to store a node in the slot that the index has for its world state, and open it unless it is a dead end.
+static int add_node( astarcontext_t* ctx, int* slot, worldstate_t ws, int parent, int action, int g, int h )
+{
+	const int idx = ctx->numNodes++;
+	ctx->nodews[ idx ] = ws;
+	ctx->nodeparent[ idx ] = parent;
+	ctx->nodeaction[ idx ] = (int16_t)action;
+	ctx->nodeg[ idx ] = g;
+	ctx->nodeh[ idx ] = h;
+	ctx->nodeheapidx[ idx ] = -1;
+	*slot = idx;
+	ctx->stats.generated++;
+	// remember a dead end, but do not open it.
+	if ( h < H_INF ) heap_push( ctx, idx );
+	trace( ctx, ASTAR_TRACE_GENERATE, idx );
+	return idx;
+}
+
+
+//!< Internal function to consider a cheaper path to a stored node, which (re)opens it.
+static void improve_node( astarcontext_t* ctx, int idx, int parent, int action, int g )
+{
+	// only a cheaper path is of interest. A dead end is of no interest at all.
+	if ( g >= ctx->nodeg[ idx ] || ctx->nodeh[ idx ] >= H_INF ) return;
+	ctx->nodeg[ idx ] = g;
+	ctx->nodeparent[ idx ] = parent;
+	ctx->nodeaction[ idx ] = (int16_t)action;
+	const int pos = ctx->nodeheapidx[ idx ];
+	if ( pos >= 0 )
+	{
+		// node in OPEN: new path is better, so decrease its key.
+		ctx->opened[ pos ].f = calc_f( ctx, g, ctx->nodeh[ idx ] );
+		heap_up( ctx, pos );
+		ctx->stats.reopenedFromOpen++;
+	}
+	else
+	{
+		// node in CLOSED: new path is better, so re-open it.
+		ctx->numClosed--;
+		heap_push( ctx, idx );
+		ctx->stats.reopenedFromClosed++;
 	}
-	idx++;	// point to last filled
+	trace( ctx, ASTAR_TRACE_GENERATE, idx );
+}
+
+
+//!< Internal function to reconstruct the plan by following parents from last node to initial node.
+static void reconstruct_plan( astarcontext_t* ctx, actionplanner_t const* ap, int goalidx, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	int numsteps = 0;
+	for ( int i=goalidx; ctx->nodeaction[ i ] >= 0; i=ctx->nodeparent[ i ] )
+		numsteps++;
+	const int skip = numsteps > *plansize ? numsteps - *plansize : 0;	// if the plan does not fit, return its tail.
 
-	if ( idx > 0 )
-		for ( int i=0; i<numsteps; ++i )
+	int step = numsteps - 1;
+	for ( int i=goalidx; ctx->nodeaction[ i ] >= 0; i=ctx->nodeparent[ i ], --step )
+		if ( step >= skip )
 		{
-			plan[ i ] = plan[ i + idx ];
-			worldstates[ i ] = worldstates[ i + idx ];
+			plan[ step - skip ] = ap->act_names[ ctx->nodeaction[ i ] ];
+			worldstates[ step - skip ] = ctx->nodews[ i ];
 		}
-	if ( idx < 0 )
+	if ( skip )
 		LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
 
 	*plansize = numsteps;
@@ -118,95 +486,1190 @@ int astar_plan
 	int* plansize
 )
 {
+	return astar_plan_ctx( &defaultctx, ap, start, goal, plan, worldstates, plansize );
+}
+
+
+int astar_plan_ctx
+(
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	if ( astar_begin( ctx, ap, start, goal ) == ASTAR_RUNNING )
+		astar_step( ctx, 0, 0 );
+	return astar_get_plan( ctx, plan, worldstates, plansize );
+}
+
+
+int astar_plan_overlay
+(
+	astarcontext_t* ctx,
+	const goapoverlay_t* overlay,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	if ( astar_begin_overlay( ctx, overlay, start, goal ) == ASTAR_RUNNING )
+		astar_step( ctx, 0, 0 );
+	return astar_get_plan( ctx, plan, worldstates, plansize );
+}
+
+
+//!< Internal function to get the actions that can contribute to the goal, from the context's cache if it was analysed before.
+static uint64_t relevant_actions( astarcontext_t* ctx, actionplanner_t const* ap, worldstate_t goal )
+{
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		bfield_setword( &goal.values, w, bfield_word( goal.values, w ) & ~bfield_word( goal.dontcare, w ) );
+	const uint64_t h = bfield_hash( goal.values ) * 0x9e3779b97f4a7c15ULL ^ bfield_hash( goal.dontcare ) * 0xc2b2ae3d27d4eb4fULL;
+	astarrelevance_t* slot = ctx->relevance + ( ( h >> 32 ) % ASTAR_RELEVANCE_SLOTS );
+	if ( slot->ap != ap || slot->version != ap->version || !bfield_equal( slot->goal.values, goal.values ) || !bfield_equal( slot->goal.dontcare, goal.dontcare ) )
+	{
+		slot->ap = ap;
+		slot->version = ap->version;
+		slot->goal = goal;
+		slot->actions = goap_relevant_actions( &ap->act_table, goal );
+	}
+	return slot->actions;
+}
+
+
+//!< Internal function to leave out the enabled actions that cannot contribute to any of the goals, counting them in the statistics.
+static uint64_t prune_actions( astarcontext_t* ctx, actionplanner_t const* ap, uint64_t enabled, const worldstate_t* goals, int numgoals )
+{
+	const uint64_t all = ap->numactions < 64 ? ( 1ULL << ap->numactions ) - 1 : ~0ULL;
+	uint64_t relevant = 0;
+	for ( int i=0; i<numgoals; ++i )
+		relevant |= relevant_actions( ctx, ap, goals[ i ] );
+	ctx->stats.pruned = bfield_popcount64( enabled & all & ~relevant );
+	return enabled & relevant;
+}
+
+
+//!< Internal function to empty the context for a forward search with the specified action costs, using only the enabled actions.
+//!< When pruning, the actions that cannot contribute to any of the goals are left out. The first goal becomes the goal of the context.
+static void prepare_search( astarcontext_t* ctx, actionplanner_t const* ap, const int* costs, uint64_t enabled, worldstate_t start, const worldstate_t* goals, int numgoals )
+{
+	// empty opened and closed lists
+	clear_nodes( ctx );
+	if ( ctx->prune )
+		enabled = prune_actions( ctx, ap, enabled, goals, numgoals );
+	ctx->ap = ap;
+	ctx->costs = costs;
+	ctx->enabled = enabled;
+	ctx->start = start;
+	ctx->goal = goals[ 0 ];
+}
+
+
+//!< Internal function to start a forward search with the specified action costs, using only the enabled actions.
+static int begin_search( astarcontext_t* ctx, actionplanner_t const* ap, const int* costs, uint64_t enabled, worldstate_t start, worldstate_t goal )
+{
+	prepare_search( ctx, ap, costs, enabled, start, &goal, 1 );
+
 	// put start in opened list
-	numOpened=0;
-	astarnode_t n0;
-	n0.ws = start;
-	n0.parentws = start;
-	n0.g = 0;
-	n0.h = calc_h( start, goal );
-	n0.f = n0.g + n0.h;
-	n0.actionname = 0;
-	opened[ numOpened++ ] = n0;
-	// empty closed list
-	numClosed=0;
+	if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ctx->status = ASTAR_OVERBUDGET; }
+	add_node( ctx, slot_in_nodehash( ctx, start ), start, -1, -1, 0, calc_h( ctx, start, goal, 0 ) );
+	return ctx->status = ASTAR_RUNNING;
+}
 
-	do
+
+int astar_begin( astarcontext_t* ctx, actionplanner_t const* ap, worldstate_t start, worldstate_t goal )
+{
+	return begin_search( ctx, ap, ap->act_costs, ~0ULL, start, goal );
+}
+
+
+int astar_begin_overlay( astarcontext_t* ctx, const goapoverlay_t* overlay, worldstate_t start, worldstate_t goal )
+{
+	return begin_search( ctx, overlay->domain, overlay->act_costs, overlay->enabled, start, goal );
+}
+
+
+//!< Internal function to read a clock in microseconds, for time sliced searches and statistics.
+static int64_t now_us( void )
+{
+#if defined( _WIN32 )
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency( &freq );
+	QueryPerformanceCounter( &count );
+	return (int64_t)( count.QuadPart * 1000000 / freq.QuadPart );
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+//!< Internal function to expand nodes until the search ends, or until we did maxexpansions (if > 0) or passed the deadline (if not 0).
+static int step_search( astarcontext_t* ctx, int maxexpansions, int64_t deadline )
+{
+	actionplanner_t const* ap = ctx->ap;
+	const worldstate_t goal = ctx->goal;
+
+	for ( int expansions=0; maxexpansions<=0 || expansions<maxexpansions; ++expansions )
 	{
-		if ( numOpened == 0 ) { LOGI( "Did not find a path." ); return -1; }
-		// find the node with lowest rank
-		int lowestIdx=-1;
-		int lowestVal=INT_MAX;
-		for ( int i=0; i<numOpened; ++i )
+		if ( deadline && expansions > 0 && now_us() >= deadline ) break;
+		if ( ctx->numOpened == 0 ) { LOGI( "Did not find a path." ); return ctx->status = ASTAR_NOPATH; }
+		// remove the node with the lowest rank
+		const int curidx = heap_pop( ctx );
+		// if it matches the goal, we are done!
+		const worldstate_t curws = ctx->nodews[ curidx ];
+		const bool match = bfield_match( curws.values, goal.values, goal.dontcare );
+ 		if ( match ) 
+		{
+			ctx->goalidx = curidx;
+			ctx->bestidx = curidx;
+			trace( ctx, ASTAR_TRACE_GOAL, curidx );
+			return ctx->status = ctx->nodeg[ curidx ];
+		}
+		// add it to closed
+		note_expansion( ctx, curidx );
+		// iterate over neighbours
+		int actions[ MAXACTIONS ];
+		worldstate_t to[ MAXACTIONS ];
+		const uint64_t expand = ctx->stubborn ? goap_stubborn_actions( &ap->act_table, ctx->enabled, curws.values, goal ) : ctx->enabled;
+		const int numtransitions = goap_get_successors( &ap->act_table, expand, curws, to, actions, MAXACTIONS );
+		ctx->stats.successors += numtransitions;
+		for ( int i=0; i<numtransitions; ++i )
 		{
-			if ( opened[ i ].f < lowestVal )
+			// storage may move when it grows, so make room before we hold on to a slot.
+			if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ctx->status = ASTAR_OVERBUDGET; }
+			const int cost = ctx->nodeg[ curidx ] + ctx->costs[ actions[ i ] ];
+			int* slot = slot_in_nodehash( ctx, to[ i ] );
+			if ( *slot >= 0 )
+			{
+				// neighbor in OPEN or CLOSED:
+				improve_node( ctx, *slot, curidx, actions[ i ], cost );
+			}
+			else
 			{
-				lowestVal = opened[ i ].f;
-				lowestIdx = i;
+				// neighbor not in OPEN and neighbor not in CLOSED:
+				const int idx = add_node( ctx, slot, to[ i ], curidx, actions[ i ], cost, calc_h( ctx, to[ i ], goal, 0 ) );
+				// the node closest to the goal so far is where a partial plan leads.
+				if ( ranks_closer( ctx, idx, ctx->bestidx ) ) ctx->bestidx = idx;
 			}
 		}
+	}
+	return ctx->status;
+}
+
+
+int astar_step( astarcontext_t* ctx, int maxexpansions, int maxmicroseconds )
+{
+	if ( ctx->status != ASTAR_RUNNING ) return ctx->status;
+	const int64_t t0 = now_us();
+	const int status = step_search( ctx, maxexpansions, maxmicroseconds > 0 ? t0 + maxmicroseconds : 0 );
+	note_time( ctx, t0, now_us() );
+	return status;
+}
+
+
+int astar_status( const astarcontext_t* ctx )
+{
+	return ctx->status;
+}
+
+
+int astar_get_plan( astarcontext_t* ctx, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	if ( ctx->status < 0 || ctx->goalidx < 0 ) return ctx->status;
+	reconstruct_plan( ctx, ctx->ap, ctx->goalidx, plan, worldstates, plansize );
+	return ctx->status;
+}
+
+
+int astar_get_partial_plan( astarcontext_t* ctx, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	if ( ctx->numNodes == 0 || ctx->partial ) { *plansize = 0; return ASTAR_NOPATH; }
+	reconstruct_plan( ctx, ctx->ap, ctx->bestidx, plan, worldstates, plansize );
+	return ctx->nodeg[ ctx->bestidx ];
+}
+
+
+//!< Internal function to reconstruct the plan of a regression search. Following parents from the node that the start satisfies towards the goal
+//!< gives the actions in forward order. The world states are found by replaying those actions from the start.
+static void reconstruct_regressed_plan( astarcontext_t* ctx, actionplanner_t const* ap, int startidx, worldstate_t start, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	// count the steps first, so that we know which tail of the plan to return if it does not fit.
+	int numsteps = 0;
+	for ( int i=startidx; ctx->nodeaction[ i ] >= 0; i=ctx->nodeparent[ i ] )
+		numsteps++;
+	const int skip = numsteps > *plansize ? numsteps - *plansize : 0;
+
+	worldstate_t ws = start;
+	int step = 0;
+	for ( int i=startidx; ctx->nodeaction[ i ] >= 0; i=ctx->nodeparent[ i ], ++step )
+	{
+		ws = goap_apply_action( &ap->act_table, ctx->nodeaction[ i ], ws );
+		if ( step >= skip )
+		{
+			plan[ step - skip ] = ap->act_names[ ctx->nodeaction[ i ] ];
+			worldstates[ step - skip ] = ws;
+		}
+	}
+	if ( skip )
+		LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+
+	*plansize = numsteps;
+}
+
+
+//!< Internal function to run a regression search, from goal back to start, on an emptied context.
+static int regress_search( astarcontext_t* ctx, actionplanner_t const* ap, worldstate_t start, worldstate_t goal, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	// clear the values of atoms that do not matter, so that equal partial states compare equal.
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		bfield_setword( &goal.values, w, bfield_word( goal.values, w ) & ~bfield_word( goal.dontcare, w ) );
+
+	// all subgoals are estimated from the same start, so the relaxed literal costs only need computing once.
+	int litcost[ 2*MAXATOMS ];
+	if ( ctx->heuristic != ASTAR_H_MISMATCH )
+		relaxed_costs( ctx, start.values, ctx->heuristic == ASTAR_H_ADD, litcost );
+	const int* hcosts = ctx->heuristic != ASTAR_H_MISMATCH ? litcost : 0;
+
+	// put goal in opened list
+	if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ctx->status = ASTAR_OVERBUDGET; }
+	add_node( ctx, slot_in_nodehash( ctx, goal ), goal, -1, -1, 0, calc_h( ctx, start, goal, hcosts ) );
+
+	do
+	{
+		if ( ctx->numOpened == 0 ) { LOGI( "Did not find a path." ); return ctx->status = ASTAR_NOPATH; }
 		// remove the node with the lowest rank
-		astarnode_t cur = opened[ lowestIdx ];
-		if ( numOpened ) opened[ lowestIdx ] = opened[ numOpened-1 ];
-		numOpened--;
-		//static char dsc[2048];
-		//goap_worldstate_description( ap, &cur.ws, dsc, sizeof(dsc) );
-		//LOGI( dsc );
-		// if it matches the goal, we are done!
-		const bfield_t care = ( goal.dontcare ^ -1LL );
-		const bool match = ( ( cur.ws.values & care ) == ( goal.values & care ) );
- 		if ( match ) 
+		const int curidx = heap_pop( ctx );
+		// if the start satisfies this subgoal, we are done!
+		const worldstate_t curws = ctx->nodews[ curidx ];
+		if ( bfield_match( start.values, curws.values, curws.dontcare ) )
+		{
+			trace( ctx, ASTAR_TRACE_GOAL, curidx );
+			reconstruct_regressed_plan( ctx, ap, curidx, start, plan, worldstates, plansize );
+			return ctx->status = ctx->nodeg[ curidx ];
+		}
+		// add it to closed
+		note_expansion( ctx, curidx );
+		// iterate over the subgoals from which a single action reaches this one
+		for ( int a=0; a<ap->act_table.numactions; ++a )
+		{
+			worldstate_t pre;
+			if ( !goap_regress_action( &ap->act_table, a, curws, &pre ) ) continue;
+			ctx->stats.successors++;
+			// storage may move when it grows, so make room before we hold on to a slot.
+			if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ctx->status = ASTAR_OVERBUDGET; }
+			const int cost = ctx->nodeg[ curidx ] + ctx->costs[ a ];
+			int* slot = slot_in_nodehash( ctx, pre );
+			if ( *slot >= 0 )
+				improve_node( ctx, *slot, curidx, a, cost );
+			else
+				add_node( ctx, slot, pre, curidx, a, cost, calc_h( ctx, start, pre, hcosts ) );
+		}
+	} while( true );
+
+	return ctx->status = ASTAR_NOPATH;
+}
+
+
+int astar_plan_regressive
+(
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	return astar_plan_regressive_ctx( &defaultctx, ap, start, goal, plan, worldstates, plansize );
+}
+
+
+int astar_plan_regressive_ctx
+(
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	// empty opened and closed lists
+	clear_nodes( ctx );
+	ctx->partial = true;
+	ctx->ap = ap;
+	ctx->costs = ap->act_costs;
+	ctx->enabled = ~0ULL;
+	const int64_t t0 = now_us();
+	const int result = regress_search( ctx, ap, start, goal, plan, worldstates, plansize );
+	note_time( ctx, t0, now_us() );
+	return result;
+}
+
+
+//!< The cheapest join of the two halves of a bidirectional search found so far: a forward node whose state satisfies the partial state of a backward node.
+typedef struct
+{
+	int cost;	//!< The cost of the plan through both nodes, H_INF if the halves have not met yet.
+	int fwdidx;	//!< The node of the forward half.
+	int bwdidx;	//!< The node of the backward half.
+} meeting_t;
+
+
+//!< Internal function to find the index slot for a mask. The slot holds the position of the mask, or is empty (-1) if the backward half has no node with it yet.
+static int* slot_in_maskhash( const struct astarmeet* meet, bfield_t mask )
+{
+	const uint64_t hmask = 2 * meet->maxMasks - 1;
+	uint64_t h = bfield_hash( mask ) & hmask;
+	while ( meet->maskhash[ h ] >= 0 && !bfield_equal( meet->masks[ meet->maskhash[ h ] ].dontcare, mask ) )
+		h = ( h + 1 ) & hmask;
+	return meet->maskhash + h;
+}
+
+
+//!< Internal function to find the index slot for mask m and the values of a state, which need not be cleared on the atoms that m does not care about.
+//!< Claims the slot if it is empty. Returns null if storage exceeds the budget.
+static meetslot_t* slot_in_meet( struct astarmeet* meet, const astarcontext_t* fwd, int m, bfield_t values )
+{
+	if ( 2 * ( meet->numSlots + 1 ) > meet->slotsSize )
+	{
+		const int size = meet->slotsSize ? 2 * meet->slotsSize : 2 * ASTAR_CHUNK;
+		const size_t budget = fwd->budget ? fwd->budget : ASTAR_DEFAULT_BUDGET;
+		if ( (size_t)size * sizeof( meetslot_t ) > budget ) return 0;
+		meetslot_t* slots = (meetslot_t*) malloc( size * sizeof( meetslot_t ) );
+		if ( !slots ) return 0;
+		for ( int i=0; i<size; ++i ) slots[ i ].generation = meet->generation - 1;
+		for ( int i=0; i<meet->slotsSize; ++i )
+		{
+			const meetslot_t* old = meet->slots + i;
+			if ( old->generation != meet->generation ) continue;
+			uint64_t h = ( bfield_hash( old->values ) ^ (uint64_t)old->mask * 0x9e3779b97f4a7c15ULL ) & ( size - 1 );
+			while ( slots[ h ].generation == meet->generation ) h = ( h + 1 ) & ( size - 1 );
+			slots[ h ] = *old;
+		}
+		free( meet->slots );
+		meet->slots = slots;
+		meet->slotsSize = size;
+	}
+	const bfield_t key = bfield_assign( bfield_zero(), values, meet->masks[ m ].dontcare );
+	const uint64_t hmask = meet->slotsSize - 1;
+	uint64_t h = ( bfield_hash( key ) ^ (uint64_t)m * 0x9e3779b97f4a7c15ULL ) & hmask;
+	while ( meet->slots[ h ].generation == meet->generation && ( meet->slots[ h ].mask != m || !bfield_equal( meet->slots[ h ].values, key ) ) )
+		h = ( h + 1 ) & hmask;
+	meetslot_t* slot = meet->slots + h;
+	if ( slot->generation != meet->generation )
+	{
+		slot->values = key;
+		slot->generation = meet->generation;
+		slot->mask = m;
+		slot->fwdidx = -1;
+		slot->bwdidx = -1;
+		meet->numSlots++;
+	}
+	return slot;
+}
+
+
+//!< Internal function to keep the cheapest join of the two halves.
+static void note_meeting( const astarcontext_t* fwd, const astarcontext_t* bwd, int fwdidx, int bwdidx, meeting_t* best )
+{
+	const int cost = fwd->nodeg[ fwdidx ] + bwd->nodeg[ bwdidx ];
+	if ( cost < best->cost )
+	{
+		best->cost = cost;
+		best->fwdidx = fwdidx;
+		best->bwdidx = bwdidx;
+	}
+}
+
+
+//!< Internal function to index a forward node for an indexed mask, and join it with the backward node of the mask that its state satisfies, if there is one.
+//!< Returns false if storage exceeds the budget.
+static bool index_forward( const astarcontext_t* fwd, const astarcontext_t* bwd, int m, int idx, meeting_t* best )
+{
+	meetslot_t* slot = slot_in_meet( fwd->meet, fwd, m, fwd->nodews[ idx ].values );
+	if ( !slot ) return false;
+	if ( slot->fwdidx < 0 || fwd->nodeg[ idx ] < fwd->nodeg[ slot->fwdidx ] )
+		slot->fwdidx = idx;
+	if ( slot->bwdidx >= 0 )
+		note_meeting( fwd, bwd, idx, slot->bwdidx, best );
+	return true;
+}
+
+
+//!< Internal function to empty the index before a new search, without touching all of the storage that earlier searches left.
+static void clear_meet( struct astarmeet* meet )
+{
+	// Like clear_nodes(), remove masks in reverse order of addition, so that probing for one only passes over older masks, which are still indexed.
+	for ( int i=meet->numMasks-1; i>=0; --i )
+		*slot_in_maskhash( meet, meet->masks[ i ].dontcare ) = -1;
+	meet->numMasks = 0;
+	meet->numSlots = 0;
+	if ( ++meet->generation == 0 )
+	{
+		// once in four billion searches, the stamps wrap around and the slots must be emptied for real.
+		for ( int i=0; i<meet->slotsSize; ++i ) meet->slots[ i ].generation = 0;
+		meet->generation = 1;
+	}
+}
+
+
+//!< Internal function to add a new backward node to the group of its mask. When the group becomes large enough, its nodes and all forward nodes are indexed.
+//!< Returns false if storage exceeds the budget.
+static bool join_group( const astarcontext_t* fwd, const astarcontext_t* bwd, int idx, meeting_t* best )
+{
+	struct astarmeet* meet = fwd->meet;
+	const worldstate_t ws = bwd->nodews[ idx ];
+	if ( idx >= meet->maxGroup )
+	{
+		int* next = (int*) realloc( meet->next, bwd->maxNodes * sizeof( int ) );
+		if ( !next ) return false;
+		meet->next = next;
+		int* group = (int*) realloc( meet->group, bwd->maxNodes * sizeof( int ) );
+		if ( !group ) return false;
+		meet->group = group;
+		meet->maxGroup = bwd->maxNodes;
+	}
+	int* maskslot = meet->maxMasks ? slot_in_maskhash( meet, ws.dontcare ) : 0;
+	int m = maskslot ? *maskslot : -1;
+	if ( m < 0 )
+	{
+		if ( meet->numMasks == meet->maxMasks )
+		{
+			const int maxmasks = meet->maxMasks ? 2 * meet->maxMasks : 16;
+			meetmask_t* masks = (meetmask_t*) realloc( meet->masks, maxmasks * sizeof( meetmask_t ) );
+			if ( !masks ) return false;
+			meet->masks = masks;
+			int* maskhash = (int*) realloc( meet->maskhash, 2 * maxmasks * sizeof( int ) );
+			if ( !maskhash ) return false;
+			meet->maskhash = maskhash;
+			meet->maxMasks = maxmasks;
+			memset( maskhash, 0xff, 2 * maxmasks * sizeof( int ) );
+			for ( int i=0; i<meet->numMasks; ++i )
+				*slot_in_maskhash( meet, meet->masks[ i ].dontcare ) = i;
+			maskslot = slot_in_maskhash( meet, ws.dontcare );
+		}
+		m = meet->numMasks++;
+		meet->masks[ m ] = (meetmask_t) { ws.dontcare, ws.values, -1, 0, H_INF };
+		*maskslot = m;
+	}
+	meetmask_t* mask = meet->masks + m;
+	meet->group[ idx ] = m;
+	meet->next[ idx ] = mask->first;
+	mask->first = idx;
+	mask->values = ws.values;
+	if ( ++mask->count > MEET_INDEX_COUNT )
+	{
+		meetslot_t* slot = slot_in_meet( meet, fwd, m, ws.values );
+		if ( !slot ) return false;
+		slot->bwdidx = idx;
+	}
+	else if ( mask->count == MEET_INDEX_COUNT )
+	{
+		for ( int i=mask->first; i>=0; i=meet->next[ i ] )
+		{
+			meetslot_t* slot = slot_in_meet( meet, fwd, m, bwd->nodews[ i ].values );
+			if ( !slot ) return false;
+			slot->bwdidx = i;
+		}
+		for ( int i=0; i<fwd->numNodes; ++i )
+			if ( !index_forward( fwd, bwd, m, i, best ) ) return false;
+	}
+	return true;
+}
+
+
+//!< Internal function to join a forward node, new or reached by a cheaper path, with the backward nodes that its state satisfies.
+//!< Returns false if storage exceeds the budget.
+static bool meet_forward( const astarcontext_t* fwd, const astarcontext_t* bwd, int idx, meeting_t* best )
+{
+	const struct astarmeet* meet = fwd->meet;
+	const bfield_t values = fwd->nodews[ idx ].values;
+	const int g = fwd->nodeg[ idx ];
+	for ( int m=0; m<meet->numMasks; ++m )
+	{
+		const meetmask_t* mask = meet->masks + m;
+		if ( mask->count >= MEET_INDEX_COUNT )
+		{
+			if ( !index_forward( fwd, bwd, m, idx, best ) ) return false;
+		}
+		else if ( g + mask->g >= best->cost )
+			continue;
+		else if ( bfield_match( values, mask->values, mask->dontcare ) )
+			note_meeting( fwd, bwd, idx, mask->first, best );
+		else
+			for ( int i=meet->next[ mask->first ]; i>=0; i=meet->next[ i ] )
+				if ( g + bwd->nodeg[ i ] < best->cost && bfield_match( values, bwd->nodews[ i ].values, mask->dontcare ) )
+				{
+					note_meeting( fwd, bwd, idx, i, best );
+					break;	// the values of the other nodes of the group differ.
+				}
+	}
+	return true;
+}
+
+
+//!< Internal function to join a backward node, new or reached by a cheaper path, with the cheapest forward node whose state satisfies it.
+//!< Returns false if storage exceeds the budget.
+static bool meet_backward( const astarcontext_t* fwd, const astarcontext_t* bwd, int idx, meeting_t* best )
+{
+	struct astarmeet* meet = fwd->meet;
+	const worldstate_t ws = bwd->nodews[ idx ];
+	const int m = meet->group[ idx ];
+	if ( bwd->nodeg[ idx ] < meet->masks[ m ].g ) meet->masks[ m ].g = bwd->nodeg[ idx ];
+	if ( meet->masks[ m ].count >= MEET_INDEX_COUNT )
+	{
+		const meetslot_t* slot = slot_in_meet( meet, fwd, m, ws.values );
+		if ( !slot ) return false;
+		if ( slot->fwdidx >= 0 )
+			note_meeting( fwd, bwd, slot->fwdidx, idx, best );
+		return true;
+	}
+	const int g = bwd->nodeg[ idx ];
+	for ( int i=0; i<fwd->numNodes; ++i )
+		if ( g + fwd->nodeg[ i ] < best->cost && bfield_match( fwd->nodews[ i ].values, ws.values, ws.dontcare ) )
+			note_meeting( fwd, bwd, i, idx, best );
+	return true;
+}
+
+
+//!< Internal function to expand the best node of the forward half of a bidirectional search. Returns false if storage exceeds the budget.
+static bool expand_forward( astarcontext_t* fwd, const astarcontext_t* bwd, meeting_t* best )
+{
+	actionplanner_t const* ap = fwd->ap;
+	const int curidx = heap_pop( fwd );
+	const worldstate_t curws = fwd->nodews[ curidx ];
+	note_expansion( fwd, curidx );
+	int actions[ MAXACTIONS ];
+	worldstate_t to[ MAXACTIONS ];
+	const uint64_t expand = fwd->stubborn ? goap_stubborn_actions( &ap->act_table, fwd->enabled, curws.values, fwd->goal ) : fwd->enabled;
+	const int numtransitions = goap_get_successors( &ap->act_table, expand, curws, to, actions, MAXACTIONS );
+	fwd->stats.successors += numtransitions;
+	for ( int i=0; i<numtransitions; ++i )
+	{
+		// storage may move when it grows, so make room before we hold on to a slot.
+		if ( !reserve_node( fwd ) ) return false;
+		const int cost = fwd->nodeg[ curidx ] + fwd->costs[ actions[ i ] ];
+		int* slot = slot_in_nodehash( fwd, to[ i ] );
+		int idx = *slot;
+		if ( idx >= 0 )
+		{
+			const int g = fwd->nodeg[ idx ];
+			improve_node( fwd, idx, curidx, actions[ i ], cost );
+			if ( fwd->nodeg[ idx ] == g ) continue;
+		}
+		else
+			idx = add_node( fwd, slot, to[ i ], curidx, actions[ i ], cost, calc_h( fwd, to[ i ], fwd->goal, 0 ) );
+		if ( !meet_forward( fwd, bwd, idx, best ) ) return false;
+	}
+	return true;
+}
+
+
+//!< Internal function to expand the best node of the backward half of a bidirectional search, estimating subgoals with the literal costs of the start.
+//!< Returns false if storage exceeds the budget.
+static bool expand_backward( const astarcontext_t* fwd, astarcontext_t* bwd, const int* hcosts, meeting_t* best )
+{
+	actionplanner_t const* ap = bwd->ap;
+	const int curidx = heap_pop( bwd );
+	const worldstate_t curws = bwd->nodews[ curidx ];
+	note_expansion( bwd, curidx );
+	for ( int a=0; a<ap->act_table.numactions; ++a )
+	{
+		worldstate_t pre;
+		if ( !( ( bwd->enabled >> a ) & 1 ) || !goap_regress_action( &ap->act_table, a, curws, &pre ) ) continue;
+		bwd->stats.successors++;
+		// storage may move when it grows, so make room before we hold on to a slot.
+		if ( !reserve_node( bwd ) ) return false;
+		const int cost = bwd->nodeg[ curidx ] + bwd->costs[ a ];
+		int* slot = slot_in_nodehash( bwd, pre );
+		int idx = *slot;
+		if ( idx >= 0 )
+		{
+			const int g = bwd->nodeg[ idx ];
+			improve_node( bwd, idx, curidx, a, cost );
+			if ( bwd->nodeg[ idx ] == g ) continue;
+		}
+		else
+		{
+			idx = add_node( bwd, slot, pre, curidx, a, cost, calc_h( bwd, bwd->start, pre, hcosts ) );
+			if ( !join_group( fwd, bwd, idx, best ) ) return false;
+		}
+		if ( !meet_backward( fwd, bwd, idx, best ) ) return false;
+	}
+	return true;
+}
+
+
+//!< Internal function to reconstruct the plan of a bidirectional search: the forward half up to the join, followed by the actions of the backward half,
+//!< which are replayed from the state at the join to get the world states.
+static void reconstruct_joined_plan( const astarcontext_t* fwd, const astarcontext_t* bwd, meeting_t join, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	actionplanner_t const* ap = fwd->ap;
+	int numforward = 0;
+	for ( int i=join.fwdidx; fwd->nodeaction[ i ] >= 0; i=fwd->nodeparent[ i ] )
+		numforward++;
+	int numsteps = numforward;
+	for ( int i=join.bwdidx; bwd->nodeaction[ i ] >= 0; i=bwd->nodeparent[ i ] )
+		numsteps++;
+	const int skip = numsteps > *plansize ? numsteps - *plansize : 0;	// if the plan does not fit, return its tail.
+
+	int step = numforward - 1;
+	for ( int i=join.fwdidx; fwd->nodeaction[ i ] >= 0; i=fwd->nodeparent[ i ], --step )
+		if ( step >= skip )
+		{
+			plan[ step - skip ] = ap->act_names[ fwd->nodeaction[ i ] ];
+			worldstates[ step - skip ] = fwd->nodews[ i ];
+		}
+	worldstate_t ws = fwd->nodews[ join.fwdidx ];
+	step = numforward;
+	for ( int i=join.bwdidx; bwd->nodeaction[ i ] >= 0; i=bwd->nodeparent[ i ], ++step )
+	{
+		ws = goap_apply_action( &ap->act_table, bwd->nodeaction[ i ], ws );
+		if ( step >= skip )
 		{
-			reconstruct_plan( &cur, plan, worldstates, plansize );
-			return cur.f;
+			plan[ step - skip ] = ap->act_names[ bwd->nodeaction[ i ] ];
+			worldstates[ step - skip ] = ws;
+		}
+	}
+	if ( skip )
+		LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+
+	*plansize = numsteps;
+}
+
+
+//!< Internal function to run a bidirectional search on two prepared contexts: fwd from the start, bwd from the normalized goal.
+static int bidirectional_search( astarcontext_t* fwd, astarcontext_t* bwd, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	// all subgoals are estimated from the same start, so the relaxed literal costs only need computing once.
+	int litcost[ 2*MAXATOMS ];
+	if ( bwd->heuristic != ASTAR_H_MISMATCH )
+		relaxed_costs( bwd, bwd->start.values, bwd->heuristic == ASTAR_H_ADD, litcost );
+	const int* hcosts = bwd->heuristic != ASTAR_H_MISMATCH ? litcost : 0;
+
+	// put start and goal in the opened lists of their halves
+	if ( !reserve_node( fwd ) || !reserve_node( bwd ) ) { LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+	add_node( fwd, slot_in_nodehash( fwd, fwd->start ), fwd->start, -1, -1, 0, calc_h( fwd, fwd->start, fwd->goal, 0 ) );
+	add_node( bwd, slot_in_nodehash( bwd, bwd->goal ), bwd->goal, -1, -1, 0, calc_h( bwd, bwd->start, bwd->goal, hcosts ) );
+	meeting_t best = { H_INF, -1, -1 };
+	clear_meet( fwd->meet );
+	if ( !join_group( fwd, bwd, 0, &best ) || !meet_backward( fwd, bwd, 0, &best ) ) { LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+
+	while ( true )
+	{
+		// each half keeps a node of every optimal plan opened, ranked at most the optimal cost. So once the best join costs no more than
+		// the lowest rank in either half, there is no cheaper plan left. A half that ran out of nodes has seen all of its plans.
+		const int fminfwd = fwd->numOpened ? fwd->opened[ 0 ].f : H_INF;
+		const int fminbwd = bwd->numOpened ? bwd->opened[ 0 ].f : H_INF;
+		const int bound = fminfwd > fminbwd ? fminfwd : fminbwd;
+		if ( fwd->numOpened + bwd->numOpened > fwd->stats.peakOpened ) fwd->stats.peakOpened = fwd->numOpened + bwd->numOpened;
+		if ( best.cost < H_INF ? best.cost <= bound : ( !fwd->numOpened || !bwd->numOpened ) ) break;
+		// grow the smaller frontier, so that both halves end up searching about as deep as the work allows.
+		const bool ok = fwd->numOpened <= bwd->numOpened ? expand_forward( fwd, bwd, &best ) : expand_backward( fwd, bwd, hcosts, &best );
+		if ( !ok ) { LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+	}
+	if ( best.cost >= H_INF ) { LOGI( "Did not find a path." ); return ASTAR_NOPATH; }
+	trace( fwd, ASTAR_TRACE_GOAL, best.fwdidx );
+	reconstruct_joined_plan( fwd, bwd, best, plan, worldstates, plansize );
+	return fwd->nodeg[ best.fwdidx ] + bwd->nodeg[ best.bwdidx ];
+}
+
+
+int astar_plan_bidirectional
+(
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	return astar_plan_bidirectional_ctx( &defaultctx, ap, start, goal, plan, worldstates, plansize );
+}
+
+
+int astar_plan_bidirectional_ctx
+(
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	if ( !ctx->reverse ) ctx->reverse = (astarcontext_t*) calloc( 1, sizeof( astarcontext_t ) );
+	if ( !ctx->meet ) ctx->meet = (struct astarmeet*) calloc( 1, sizeof( struct astarmeet ) );
+	if ( !ctx->reverse || !ctx->meet ) { LOGI( "Search exceeded its memory budget." ); return ctx->status = ASTAR_OVERBUDGET; }
+	astarcontext_t* bwd = ctx->reverse;
+	prepare_search( ctx, ap, ap->act_costs, ~0ULL, start, &goal, 1 );
+
+	// the backward half searches the partial states of regression, with the same options and actions as the forward half.
+	clear_nodes( bwd );
+	bwd->partial = true;
+	bwd->heuristic = ctx->heuristic;
+	bwd->epsilon = ctx->epsilon;
+	bwd->budget = ctx->budget;
+	bwd->ap = ap;
+	bwd->costs = ctx->costs;
+	bwd->enabled = ctx->enabled;
+	bwd->start = start;
+	// clear the values of atoms that do not matter, so that equal partial states compare equal.
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		bfield_setword( &goal.values, w, bfield_word( goal.values, w ) & ~bfield_word( goal.dontcare, w ) );
+	bwd->goal = goal;
+
+	const int64_t t0 = now_us();
+	const int result = bidirectional_search( ctx, bwd, plan, worldstates, plansize );
+	note_time( ctx, t0, now_us() );
+
+	// report the work of both halves as that of the search. The peak of opened nodes was tracked over both halves while searching.
+	const astarstats_t* s = &bwd->stats;
+	ctx->stats.expanded += s->expanded;
+	ctx->stats.generated += s->generated;
+	ctx->stats.reopenedFromOpen += s->reopenedFromOpen;
+	ctx->stats.reopenedFromClosed += s->reopenedFromClosed;
+	ctx->stats.peakClosed += s->peakClosed;
+	ctx->stats.successors += s->successors;
+	ctx->stats.successorsPerExpansion = ctx->stats.expanded ? (float)ctx->stats.successors / ctx->stats.expanded : 0.0f;
+	// the plan joins nodes of both halves, so there is no single goal node for astar_get_plan() to follow.
+	ctx->goalidx = -1;
+	return ctx->status = result;
+}
+
+
+//!< Internal function to estimate the remaining cost to the cheapest of several goals, with the offset of each goal added.
+//!< The relaxed literal costs only depend on the state, so they are computed once for all goals.
+static int calc_h_goals( const astarcontext_t* ctx, worldstate_t fr, const worldstate_t* goals, const int* offsets, int numgoals )
+{
+	int litcost[ 2*MAXATOMS ];
+	const int* hcosts = 0;
+	if ( ctx->heuristic != ASTAR_H_MISMATCH )
+	{
+		relaxed_costs( ctx, fr.values, ctx->heuristic == ASTAR_H_ADD, litcost );
+		hcosts = litcost;
+	}
+	int best = H_INF;
+	for ( int i=0; i<numgoals; ++i )
+	{
+		const int h = calc_h( ctx, fr, goals[ i ], hcosts );
+		const int offset = offsets ? offsets[ i ] : 0;
+		if ( h < H_INF && h + offset < best ) best = h + offset;
+	}
+	return best;
+}
+
+
+//!< Internal function to run a forward search on a prepared context until it finds the goal that is cheapest to reach, offset included.
+static int search_goals( astarcontext_t* ctx, const worldstate_t* goals, const int* offsets, int numgoals, int* reached )
+{
+	actionplanner_t const* ap = ctx->ap;
+	const worldstate_t start = ctx->start;
+
+	// put start in opened list
+	if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+	add_node( ctx, slot_in_nodehash( ctx, start ), start, -1, -1, 0, calc_h_goals( ctx, start, goals, offsets, numgoals ) );
+
+	int best = H_INF;	// the lowest cost plus offset of a goal reached so far.
+	while ( true )
+	{
+		// the heuristic of a node includes the offset of the goal it estimates, so once the best goal reached ranks no
+		// higher than the lowest ranked opened node, no other goal can be reached at a lower cost plus offset.
+		if ( ctx->numOpened == 0 || best <= ctx->opened[ 0 ].f ) break;
+		// remove the node with the lowest rank
+		const int curidx = heap_pop( ctx );
+		const worldstate_t curws = ctx->nodews[ curidx ];
+		// a node that reaches a goal is still expanded, as it may lead on to a goal with a lower offset.
+		uint64_t expand = ctx->stubborn ? 0 : ctx->enabled;
+		for ( int i=0; i<numgoals; ++i )
+		{
+			if ( bfield_match( curws.values, goals[ i ].values, goals[ i ].dontcare ) )
+			{
+				const int cost = ctx->nodeg[ curidx ] + ( offsets ? offsets[ i ] : 0 );
+				if ( cost < best )
+				{
+					best = cost;
+					ctx->goalidx = curidx;
+					*reached = i;
+				}
+			}
+			// each plan reaches one of the goals, so a set that is stubborn for each goal not reached yet will do for all of them.
+			else if ( ctx->stubborn )
+				expand |= goap_stubborn_actions( &ap->act_table, ctx->enabled, curws.values, goals[ i ] );
 		}
 		// add it to closed
-		closed[ numClosed++ ] = cur;
-		if ( numClosed == MAXCLOS ) { LOGI("Closed set overflow"); return -1; } // ran out of storage for closed set
+		note_expansion( ctx, curidx );
 		// iterate over neighbours
-		const char* actionnames[ MAXACTIONS ];
-		int actioncosts[ MAXACTIONS ];
+		int actions[ MAXACTIONS ];
 		worldstate_t to[ MAXACTIONS ];
-		const int numtransitions = goap_get_possible_state_transitions( ap, cur.ws, to, actionnames, actioncosts, MAXACTIONS );
-		//LOGI( "%d neighbours", numtransitions );
+		const int numtransitions = goap_get_successors( &ap->act_table, expand, curws, to, actions, MAXACTIONS );
+		ctx->stats.successors += numtransitions;
 		for ( int i=0; i<numtransitions; ++i )
 		{
-			astarnode_t nb;
-			const int cost = cur.g + actioncosts[ i ];
-			int idx_o = idx_in_opened( to[ i ] );
-			int idx_c = idx_in_closed( to[ i ] );
-			// if neighbor in OPEN and cost less than g(neighbor):
-			if ( idx_o >= 0 && cost < opened[ idx_o ].g )
+			// storage may move when it grows, so make room before we hold on to a slot.
+			if ( !reserve_node( ctx ) ) { LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+			const int cost = ctx->nodeg[ curidx ] + ctx->costs[ actions[ i ] ];
+			int* slot = slot_in_nodehash( ctx, to[ i ] );
+			if ( *slot >= 0 )
+				improve_node( ctx, *slot, curidx, actions[ i ], cost );
+			else
 			{
-				// remove neighbor from OPEN, because new path is better
-				if ( numOpened ) opened[ idx_o ] = opened[ numOpened-1 ];
-				numOpened--;
-				idx_o = -1; // BUGFIX: neighbor is no longer in OPEN, signal this so that we can re-add it.
+				const int idx = add_node( ctx, slot, to[ i ], curidx, actions[ i ], cost, calc_h_goals( ctx, to[ i ], goals, offsets, numgoals ) );
+				if ( ranks_closer( ctx, idx, ctx->bestidx ) ) ctx->bestidx = idx;
 			}
-			// if neighbor in CLOSED and cost less than g(neighbor):
-			if ( idx_c >= 0 && cost < closed[ idx_c ].g )
+		}
+	}
+	if ( ctx->goalidx < 0 ) { LOGI( "Did not find a path." ); return ASTAR_NOPATH; }
+	ctx->goal = goals[ *reached ];
+	trace( ctx, ASTAR_TRACE_GOAL, ctx->goalidx );
+	return ctx->nodeg[ ctx->goalidx ];
+}
+
+
+int astar_plan_goals
+(
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	const worldstate_t* goals,
+	const int* offsets,
+	int numgoals,
+	int* reached,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	*reached = -1;
+	if ( numgoals <= 0 ) { LOGI( "Did not find a path." ); return ctx->status = ASTAR_NOPATH; }
+	prepare_search( ctx, ap, ap->act_costs, ~0ULL, start, goals, numgoals );
+	const int64_t t0 = now_us();
+	ctx->status = search_goals( ctx, goals, offsets, numgoals, reached );
+	note_time( ctx, t0, now_us() );
+	return astar_get_plan( ctx, plan, worldstates, plansize );
+}
+
+
+#define PARALLEL_BLOCK 64	//!< The nr of nodes that a worker of a parallel search sends to another worker at once.
+#define PARALLEL_BATCH 16	//!< The nr of nodes that a worker of a parallel search expands between looking at the nodes sent to it.
+
+
+//!< A node sent to the worker that owns its world state.
+typedef struct
+{
+	worldstate_t ws;	//!< The state of the world at the node.
+	int32_t parent;		//!< Reference to the parent node, see node_ref().
+	int32_t g;		//!< The cost so far.
+	int16_t action;		//!< The action that leads from the parent to the node.
+} parallelmsg_t;
+
+
+//!< A block of nodes sent to a worker.
+typedef struct msgblock
+{
+	struct msgblock* next;	//!< The next block in the inbox.
+	int count;		//!< The nr of nodes in the block.
+	parallelmsg_t msgs[ PARALLEL_BLOCK ];	//!< The nodes.
+} msgblock_t;
+
+
+//!< The inbox of a worker: a lock-free stack of blocks, that any worker can push onto, and that its owner empties in one go.
+typedef struct
+{
+	msgblock_t* head;	//!< The last block pushed, null if the inbox is empty.
+	char pad[ 64 - sizeof( msgblock_t* ) ];	//!< Keep each inbox on its own cache line, as all workers write to them.
+} inbox_t;
+
+
+struct astarparallel
+{
+	astarcontext_t** ctxs;	//!< The context of each worker, which stores the nodes that the worker owns.
+	int numworkers;		//!< The nr of workers.
+	inbox_t* inboxes;	//!< The inbox of each worker.
+	msgblock_t** outboxes;	//!< The block that worker i is filling for worker j, at i * numworkers + j.
+	uint64_t best;		//!< The cost of the best plan found so far in the high half, and a reference to its goal node in the low half.
+	int64_t inflight;	//!< The nr of nodes sent but not yet taken in.
+	int numidle;		//!< The nr of workers that have nothing to expand below the cost of the best plan.
+	uint64_t epoch;		//!< Bumped whenever a worker stops being idle, so that termination can be detected safely.
+	int done;		//!< Set when the search is over.
+	int overbudget;		//!< Set when a worker ran out of memory, which ends the search.
+};
+
+
+//!< Internal function to refer to a node of a parallel search, which can be stored by any worker.
+static int32_t node_ref( const astarparallel_t* par, int worker, int idx )
+{
+	return idx * par->numworkers + worker;
+}
+
+
+//!< Internal function to find the worker that owns a world state. Uses other bits of the hash than the node index, so that the index stays spread out.
+static int owner_of( const astarparallel_t* par, worldstate_t ws )
+{
+	return (int)( ( bfield_hash( ws.values ) >> 32 ) % (uint64_t)par->numworkers );
+}
+
+
+//!< Internal function to take a node into the context of the worker that owns it. Returns false if the budget does not allow it.
+static bool take_node( astarparallel_t* par, astarcontext_t* ctx, worldstate_t ws, int parent, int action, int g )
+{
+	if ( !reserve_node( ctx ) || (int64_t)( ctx->numNodes + 1 ) * par->numworkers > 0x7fffffff ) return false;
+	int* slot = slot_in_nodehash( ctx, ws );
+	if ( *slot >= 0 )
+		improve_node( ctx, *slot, parent, action, g );
+	else
+		add_node( ctx, slot, ws, parent, action, g, calc_h( ctx, ws, ctx->goal, 0 ) );
+	return true;
+}
+
+
+//!< Internal function to push the block that a worker is filling for another worker onto that worker's inbox.
+static void flush_outbox( astarparallel_t* par, int from, int to )
+{
+	msgblock_t* block = par->outboxes[ from * par->numworkers + to ];
+	if ( !block ) return;
+	par->outboxes[ from * par->numworkers + to ] = 0;
+	// count the nodes before they can be taken in, so that inflight never drops below the true nr.
+	goap_atomic_add64( &par->inflight, block->count );
+	block->next = (msgblock_t*) goap_atomic_loadptr( &par->inboxes[ to ].head );
+	while ( !goap_atomic_casptr( &par->inboxes[ to ].head, &block->next, block ) ) {}
+}
+
+
+//!< Internal function to send a node to the worker that owns it. Returns false if out of memory.
+static bool send_node( astarparallel_t* par, int from, int to, worldstate_t ws, int parent, int action, int g )
+{
+	msgblock_t** outbox = par->outboxes + from * par->numworkers + to;
+	if ( !*outbox )
+	{
+		*outbox = (msgblock_t*) malloc( sizeof( msgblock_t ) );
+		if ( !*outbox ) return false;
+		(*outbox)->count = 0;
+	}
+	parallelmsg_t* msg = (*outbox)->msgs + (*outbox)->count++;
+	msg->ws = ws;
+	msg->parent = parent;
+	msg->action = (int16_t)action;
+	msg->g = g;
+	if ( (*outbox)->count == PARALLEL_BLOCK ) flush_outbox( par, from, to );
+	return true;
+}
+
+
+//!< Internal function to offer a plan to the parallel search, which keeps it if it is the cheapest so far.
+static void offer_plan( astarparallel_t* par, int cost, int32_t goalref )
+{
+	const uint64_t offer = ( (uint64_t)cost << 32 ) | (uint32_t)goalref;
+	uint64_t best = goap_atomic_load64( &par->best );
+	while ( offer < best && !goap_atomic_cas64( &par->best, &best, offer ) ) {}
+}
+
+
+//!< Internal function to let a thread that waits for work give up its time slice.
+static void relax( void )
+{
+#if defined( _WIN32 )
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+
+astarparallel_t* astar_parallel_begin( astarcontext_t** ctxs, int numworkers, actionplanner_t const* ap, worldstate_t start, worldstate_t goal )
+{
+	astarparallel_t* par = (astarparallel_t*) calloc( 1, sizeof( astarparallel_t ) );
+	if ( !par ) return 0;
+	par->inboxes = (inbox_t*) calloc( numworkers, sizeof( inbox_t ) );
+	par->outboxes = (msgblock_t**) calloc( (size_t)numworkers * numworkers, sizeof( msgblock_t* ) );
+	if ( !par->inboxes || !par->outboxes ) { free( par->inboxes ); free( par->outboxes ); free( par ); return 0; }
+	par->ctxs = ctxs;
+	par->numworkers = numworkers;
+	par->best = ( (uint64_t)H_INF << 32 ) | 0xffffffffULL;
+
+	for ( int i=0; i<numworkers; ++i )
+	{
+		prepare_search( ctxs[ i ], ap, ap->act_costs, ~0ULL, start, &goal, 1 );
+		ctxs[ i ]->status = ASTAR_RUNNING;
+	}
+	// put start in the opened list of its owner.
+	if ( !take_node( par, ctxs[ owner_of( par, start ) ], start, -1, -1, 0 ) )
+		par->overbudget = 1;
+	return par;
+}
+
+
+void astar_parallel_work( astarparallel_t* par, int nr )
+{
+	astarcontext_t* ctx = par->ctxs[ nr ];
+	actionplanner_t const* ap = ctx->ap;
+	const worldstate_t goal = ctx->goal;
+	const int64_t t0 = now_us();
+	bool idle = false;
+
+	while ( !goap_atomic_load32( &par->overbudget ) && !goap_atomic_load32( &par->done ) )
+	{
+		// take in the nodes that other workers sent us. We stop being idle before we take them in, see below.
+		msgblock_t* blocks = (msgblock_t*) goap_atomic_exchangeptr( &par->inboxes[ nr ].head, (msgblock_t*)0 );
+		if ( blocks && idle )
+		{
+			goap_atomic_add64( &par->epoch, 1 );
+			goap_atomic_add32( &par->numidle, -1 );
+			idle = false;
+		}
+		bool ok = true;
+		while ( blocks )
+		{
+			msgblock_t* next = blocks->next;
+			for ( int i=0; i<blocks->count && ok; ++i )
+				ok = take_node( par, ctx, blocks->msgs[ i ].ws, blocks->msgs[ i ].parent, blocks->msgs[ i ].action, blocks->msgs[ i ].g );
+			goap_atomic_add64( &par->inflight, -blocks->count );
+			free( blocks );
+			blocks = next;
+		}
+
+		// expand our nodes that could still lead to a cheaper plan than the best one so far.
+		for ( int expansions=0; ok && expansions<PARALLEL_BATCH; ++expansions )
+		{
+			const int bound = (int)( (uint64_t)goap_atomic_load64( &par->best ) >> 32 );
+			if ( ctx->numOpened == 0 || ctx->opened[ 0 ].f >= bound ) break;
+			if ( idle )
+			{
+				goap_atomic_add64( &par->epoch, 1 );
+				goap_atomic_add32( &par->numidle, -1 );
+				idle = false;
+			}
+			const int curidx = heap_pop( ctx );
+			const worldstate_t curws = ctx->nodews[ curidx ];
+			if ( bfield_match( curws.values, goal.values, goal.dontcare ) )
 			{
-				// remove neighbor from CLOSED
-				if ( numClosed ) closed[ idx_c ] = closed[ numClosed-1 ];
-				numClosed--;
-				idx_c = -1; // BUGFIX: neighbour is no longer in CLOSED< signal this so that we can re-add it.
+				// keep it closed, so that a cheaper path to it reopens it.
+				ctx->numClosed++;
+				offer_plan( par, ctx->nodeg[ curidx ], node_ref( par, nr, curidx ) );
+				continue;
 			}
-			// if neighbor not in OPEN and neighbor not in CLOSED:
-			if ( idx_c == -1 && idx_o == -1 )
+			note_expansion( ctx, curidx );
+			int actions[ MAXACTIONS ];
+			worldstate_t to[ MAXACTIONS ];
+			const uint64_t expand = ctx->stubborn ? goap_stubborn_actions( &ap->act_table, ctx->enabled, curws.values, goal ) : ctx->enabled;
+			const int numtransitions = goap_get_successors( &ap->act_table, expand, curws, to, actions, MAXACTIONS );
+			ctx->stats.successors += numtransitions;
+			const int32_t parent = node_ref( par, nr, curidx );
+			for ( int i=0; i<numtransitions && ok; ++i )
 			{
-				nb.ws = to[ i ];
-				nb.g = cost;
-				nb.h = calc_h( nb.ws, goal );
-				nb.f = nb.g + nb.h;
-				nb.actionname = actionnames[ i ];
-				nb.parentws = cur.ws;
-				opened[ numOpened++ ] = nb;
+				const int cost = ctx->nodeg[ curidx ] + ctx->costs[ actions[ i ] ];
+				const int owner = owner_of( par, to[ i ] );
+				ok = owner == nr ? take_node( par, ctx, to[ i ], parent, actions[ i ], cost ) : send_node( par, nr, owner, to[ i ], parent, actions[ i ], cost );
 			}
-			if ( numOpened == MAXOPEN ) { LOGI("Opened set overflow"); return -1; } // ran out of storage for opened set
 		}
-	} while( true );
+		if ( !ok )
+		{
+			LOGI( "Search exceeded its memory budget." );
+			goap_atomic_store32( &par->overbudget, 1 );
+			break;
+		}
+
+		// send what we have, so that no node waits in an outbox while its owner runs out of work.
+		for ( int to=0; to<par->numworkers; ++to )
+			flush_outbox( par, nr, to );
+
+		const int bound = (int)( (uint64_t)goap_atomic_load64( &par->best ) >> 32 );
+		if ( ctx->numOpened > 0 && ctx->opened[ 0 ].f < bound ) continue;
 
-	return -1;
+		// nothing left below the bound: we are idle. The search is over when all workers are idle and no nodes are in flight.
+		// A worker stops being idle (bumping epoch) before it takes in nodes, so if epoch did not change while we looked,
+		// all workers were idle at once with nothing in flight, and none of them can have work again.
+		if ( !idle )
+		{
+			goap_atomic_add32( &par->numidle, 1 );
+			idle = true;
+		}
+		const uint64_t epoch = goap_atomic_load64( &par->epoch );
+		if ( goap_atomic_load32( &par->numidle ) == par->numworkers &&
+		     goap_atomic_load64( &par->inflight ) == 0 &&
+		     (uint64_t)goap_atomic_load64( &par->epoch ) == epoch )
+		{
+			goap_atomic_store32( &par->done, 1 );
+			break;
+		}
+		relax();
+	}
+	note_time( ctx, t0, now_us() );
 }
 
 
+int astar_parallel_end( astarparallel_t* par, astarstats_t* stats, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	const int n = par->numworkers;
+	memset( stats, 0, sizeof( astarstats_t ) );
+	for ( int i=0; i<n; ++i )
+	{
+		const astarstats_t* s = &par->ctxs[ i ]->stats;
+		stats->expanded += s->expanded;
+		stats->generated += s->generated;
+		stats->reopenedFromOpen += s->reopenedFromOpen;
+		stats->reopenedFromClosed += s->reopenedFromClosed;
+		stats->peakOpened += s->peakOpened;
+		stats->peakClosed += s->peakClosed;
+		stats->successors += s->successors;
+		if ( s->microseconds > stats->microseconds ) stats->microseconds = s->microseconds;
+		stats->pruned = s->pruned;
+	}
+	stats->successorsPerExpansion = stats->expanded ? (float)stats->successors / stats->expanded : 0.0f;
+
+	// free the nodes that were still on their way when the search ended.
+	for ( int i=0; i<n*n; ++i ) free( par->outboxes[ i ] );
+	for ( int i=0; i<n; ++i )
+		for ( msgblock_t* b=par->inboxes[ i ].head; b; )
+		{
+			msgblock_t* next = b->next;
+			free( b );
+			b = next;
+		}
+
+	const int cost = (int)( par->best >> 32 );
+	int result = par->overbudget ? ASTAR_OVERBUDGET : cost >= H_INF ? ASTAR_NOPATH : cost;
+	if ( result >= 0 )
+	{
+		// follow the parents from the goal back to the start, over the contexts of all workers.
+		// the cost of the plan is that of its actions: with an inadmissible heuristic, the goal can have been reached before its parents were improved.
+		const int32_t goalref = (int32_t)( par->best & 0xffffffffULL );
+		int numsteps = 0;
+		result = 0;
+		for ( int32_t r=goalref; par->ctxs[ r % n ]->nodeaction[ r / n ] >= 0; r=par->ctxs[ r % n ]->nodeparent[ r / n ] )
+		{
+			numsteps++;
+			result += par->ctxs[ r % n ]->costs[ par->ctxs[ r % n ]->nodeaction[ r / n ] ];
+		}
+		const int skip = numsteps > *plansize ? numsteps - *plansize : 0;	// if the plan does not fit, return its tail.
+		int step = numsteps - 1;
+		for ( int32_t r=goalref; par->ctxs[ r % n ]->nodeaction[ r / n ] >= 0; r=par->ctxs[ r % n ]->nodeparent[ r / n ], --step )
+			if ( step >= skip )
+			{
+				const astarcontext_t* c = par->ctxs[ r % n ];
+				plan[ step - skip ] = c->ap->act_names[ c->nodeaction[ r / n ] ];
+				worldstates[ step - skip ] = c->nodews[ r / n ];
+			}
+		if ( skip )
+			LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+		*plansize = numsteps;
+	}
+	else if ( result == ASTAR_NOPATH )
+		LOGI( "Did not find a path." );
+	for ( int i=0; i<n; ++i ) par->ctxs[ i ]->status = result;
+	free( par->inboxes );
+	free( par->outboxes );
+	free( par );
+	return result;
+}
@@ -22,31 +22,132 @@ extern "C"
 #else
 #include <stdio.h>
 #endif
+#ifdef GOAP_QUIET
+#define LOGI(...) {}	// no messages about searches that did not find a plan, e.g. when timing many of them.
+#else
 #define LOGI(...) { printf( __VA_ARGS__ ); printf("\n"); }
+#endif
 #define LOGW(...) { printf( "WRN " __VA_ARGS__ ); printf("\n"); }
 #define LOGE(...) { printf( "ERR " __VA_ARGS__ ); printf("\n"); }
 #endif
 
 #include "goap.h"
 
-struct astarnode;
+#include <stddef.h>
+
+//!< An entry in the opened set: a node and the keys it ranks on, kept together so that heap operations touch nothing else.
+typedef struct
+{
+	int f;		//!< g+h combined, with h weighted by 1+epsilon.
+	int h;		//!< The heuristic, which breaks ties on f.
+	int node;	//!< Index of the node.
+} astaropen_t;
+
+
+#define ASTAR_CHUNK 1024			//!< The nr of nodes by which node storage grows when it runs out.
+#define ASTAR_DEFAULT_BUDGET ( 4 << 20 )	//!< Memory budget in bytes for a search, if the context does not specify one.
+#define ASTAR_NODE_BYTES ( sizeof( worldstate_t ) + 4 * sizeof( int32_t ) + sizeof( int16_t ) + sizeof( astaropen_t ) )	//!< Storage per node, not counting the index.
 
-//!< A node in our network of world states.
-struct astarnode
+#define ASTAR_NOPATH -1			//!< Returned by astar_plan() when the desired world state cannot be reached.
+#define ASTAR_OVERBUDGET -2		//!< Returned by astar_plan() when the search needed more memory than its budget allows.
+#define ASTAR_RUNNING -3		//!< Returned by astar_step() when the search has not finished yet.
+
+#define ASTAR_TRACE_EXPAND 0		//!< Trace event: a node is taken from the opened set, and its successors are generated.
+#define ASTAR_TRACE_GENERATE 1		//!< Trace event: a node is added, or reached by a cheaper path than before.
+#define ASTAR_TRACE_GOAL 2		//!< Trace event: a node reaches the goal, which ends the search.
+
+#define ASTAR_H_MISMATCH 0		//!< Heuristic: the nr of atoms that differ from the goal. Cheap, but ignores action costs, so plans may not be optimal.
+#define ASTAR_H_MAX 1			//!< Heuristic: the cost of the most expensive goal atom, when actions never undo anything. Admissible, so plans are optimal.
+#define ASTAR_H_ADD 2			//!< Heuristic: the summed cost of all goal atoms, when actions never undo anything. Not admissible, but well informed.
+
+#define ASTAR_RELEVANCE_SLOTS 8		//!< The nr of goals for which a context remembers which actions are relevant.
+
+
+//!< Statistics of a search, kept in its context. Reset when a search begins, and accumulated over all of its steps.
+typedef struct
 {
-	worldstate_t ws;		//!< The state of the world at this node.
-	int g;				//!< The cost so far.
-	int h;				//!< The heuristic for remaining cost (don't overestimate!)
-	int f;				//!< g+h combined.
-	const char* actionname;		//!< How did we get to this node?
-	worldstate_t parentws;		//!< Where did we come from?
-};
+	int expanded;		//!< The nr of nodes expanded.
+	int generated;		//!< The nr of nodes added to storage.
+	int reopenedFromOpen;	//!< The nr of times an opened node was reached by a cheaper path.
+	int reopenedFromClosed;	//!< The nr of times a closed node was reached by a cheaper path, and opened again.
+	int peakOpened;		//!< The largest size of the opened set.
+	int peakClosed;		//!< The largest size of the closed set.
+	int successors;		//!< The nr of successors of all expanded nodes.
+	float successorsPerExpansion;	//!< The average nr of successors of an expanded node.
+	int64_t microseconds;	//!< Wall time spent searching.
+	int pruned;		//!< The nr of actions left out because they cannot contribute to the goal.
+} astarstats_t;
 
 
-typedef struct astarnode astarnode_t;
+//!< The actions that are relevant to a goal, remembered so that a goal that is asked for often is only analysed once.
+typedef struct
+{
+	actionplanner_t const* ap;	//!< The planner that was analysed, null for an empty slot.
+	unsigned int version;		//!< The version of that planner.
+	worldstate_t goal;		//!< The goal, with the values of atoms that do not matter cleared.
+	uint64_t actions;		//!< Bit i is set if action i can contribute to the goal.
+} astarrelevance_t;
 
 
-//! Make a plan of actions that will reach desired world state. Returns total cost of the plan.
+struct astarcontext;
+struct astarmeet;
+
+//!< Called on search events, if set in the context. Event is one of ASTAR_TRACE_*, node is the index of the node in the context's node arrays.
+typedef void (*astartrace_t)( int event, const struct astarcontext* ctx, int node, void* userdata );
+
+
+//!< The state of a search. Owned by the caller, so that each thread can plan with its own context.
+//!< Storage grows on demand and is kept for the next search, so that planning does not allocate once warmed up.
+//!< A zero-initialized context is ready for use.
+//!< The nodes we have seen, opened and closed alike, are stored as separate arrays indexed by node, so that each pass only touches the fields it needs.
+typedef struct astarcontext
+{
+	worldstate_t* nodews;	//!< The state of the world at each node.
+	int32_t* nodeparent;	//!< Where did we come from? Index of the parent node, -1 for the root.
+	int16_t* nodeaction;	//!< How did we get here? Index of the action, -1 for the root.
+	int32_t* nodeg;		//!< The cost so far.
+	int32_t* nodeh;		//!< The heuristic for remaining cost (don't overestimate!)
+	int32_t* nodeheapidx;	//!< Position of the node in the opened heap, or -1 if it is not opened.
+	int numNodes;		//!< The nr of nodes in storage.
+	int maxNodes;		//!< The nr of nodes that storage has room for.
+	int* nodehash;		//!< Open addressing index that maps a world state onto its node in storage, -1 for empty slots.
+	int hashSize;		//!< The nr of slots in the index, a power of two and at least twice maxNodes.
+	astaropen_t* opened;	//!< The set of nodes we should consider: a binary heap, lowest rank on top.
+	int numOpened;		//!< The nr of nodes in our opened set.
+	int numClosed;		//!< The nr of nodes in our closed set.
+	bool partial;		//!< Do the nodes hold partial world states? Set by the search itself, for a regression search.
+	int heuristic;		//!< The estimate of the remaining cost, one of ASTAR_H_*. Can be changed between calls.
+	float epsilon;		//!< Nodes rank on g + (1+epsilon) * h. Use 0 for plain A*. With an admissible heuristic, plans cost at most (1+epsilon) times the optimum.
+				//!< Larger values expand fewer nodes; a very large value makes the search greedy. Can be changed between calls.
+	bool prune;		//!< Leave out the actions that cannot contribute to the goal, see goap_relevant_actions(). Plans stay as cheap. Can be changed between calls.
+	astarrelevance_t relevance[ ASTAR_RELEVANCE_SLOTS ];	//!< The relevant actions of recent goals, used when pruning.
+	bool stubborn;		//!< Expand only a strong stubborn set of actions at each node, see goap_stubborn_actions(), so that independent actions are not tried in every order.
+				//!< Plans stay optimal. Can be changed between calls.
+	actionplanner_t const* ap;	//!< The planner of the search in progress.
+	const int* costs;	//!< The action costs of the search in progress: those of the planner, or of an overlay.
+	uint64_t enabled;	//!< Bit i is set if the search in progress may use action i.
+	worldstate_t start;	//!< The start state of the search in progress.
+	worldstate_t goal;	//!< The goal of the search in progress.
+	int status;		//!< ASTAR_RUNNING while the search goes on, otherwise its outcome: the plan cost, ASTAR_NOPATH or ASTAR_OVERBUDGET.
+	int goalidx;		//!< The node that reached the goal, -1 until it is found.
+	int bestidx;		//!< The node with the lowest heuristic so far, where the best partial plan leads.
+	astarstats_t stats;	//!< Statistics of the last search.
+	astartrace_t trace;	//!< Called on every search event, if not null. Can be changed between calls.
+	void* traceuser;	//!< Passed to the trace function.
+	size_t budget;		//!< Max nr of bytes the next search may use for storage, 0 for ASTAR_DEFAULT_BUDGET. Can be changed between calls.
+	struct astarcontext* reverse;	//!< The backward half of a bidirectional search, allocated by the first one and freed with the context.
+	struct astarmeet* meet;		//!< Where the halves of a bidirectional search meet, allocated by the first one and freed with the context.
+} astarcontext_t;
+
+
+//! Initialize a search context. Same as zero-initializing it.
+extern void astar_context_init( astarcontext_t* ctx );
+
+//! Free the storage that a search context has accumulated. The context can be used again afterwards.
+extern void astar_context_release( astarcontext_t* ctx );
+
+
+//! Make a plan of actions that will reach desired world state. Returns total cost of the plan, ASTAR_NOPATH or ASTAR_OVERBUDGET.
 extern int astar_plan
 (
         actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
@@ -57,6 +158,134 @@ extern int astar_plan
         int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
 );
 
+//! Same as astar_plan(), but uses the caller's context instead of the shared one, which makes it safe to call from many threads at once.
+extern int astar_plan_ctx
+(
+        astarcontext_t* ctx,            //!< search state, reused across calls, one per thread
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Same as astar_plan_ctx(), but plans for the agent of an overlay on a frozen, shared planner: only its enabled actions are used, at its costs.
+extern int astar_plan_overlay
+(
+        astarcontext_t* ctx,            //!< search state, reused across calls, one per thread
+        const goapoverlay_t* overlay,   //!< the agent's overlay, which names the shared planner
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Start a search that is run in slices by astar_step(), so that a hard question can be spread over several frames.
+//! Returns ASTAR_RUNNING, or ASTAR_OVERBUDGET if there is no room for the start node. The context holds the search until the next one begins.
+extern int astar_begin( astarcontext_t* ctx, actionplanner_t const* ap, worldstate_t start, worldstate_t goal );
+
+//! Same as astar_begin(), but plans for the agent of an overlay: only its enabled actions are used, at its costs.
+extern int astar_begin_overlay( astarcontext_t* ctx, const goapoverlay_t* overlay, worldstate_t start, worldstate_t goal );
+
+//! Advance the search by at most maxexpansions node expansions, and for at most maxmicroseconds. A limit of 0 means no limit.
+//! Returns ASTAR_RUNNING if the search needs more steps, otherwise the plan cost, ASTAR_NOPATH or ASTAR_OVERBUDGET.
+extern int astar_step( astarcontext_t* ctx, int maxexpansions, int maxmicroseconds );
+
+//! Poll the search: returns the same as the last astar_step().
+extern int astar_status( const astarcontext_t* ctx );
+
+//! Get the plan of a finished search. Returns the plan cost, or the status if no plan was found (yet).
+//! Not available after astar_plan_regressive() or astar_plan_bidirectional(), whose plans are only returned by those calls: the buffers are left untouched.
+extern int astar_get_plan( astarcontext_t* ctx, const char** plan, worldstate_t* worldstates, int* plansize );
+
+//! Get the plan towards the state closest to the goal (lowest heuristic) that the search has seen so far. Useful while the search is still running.
+//! Returns the cost of that partial plan. Not available for regression searches, which do not start from the start state.
+extern int astar_get_partial_plan( astarcontext_t* ctx, const char** plan, worldstate_t* worldstates, int* plansize );
+
+//! Same as astar_plan(), but searches backwards from the goal, over the partial world states that the goal's dontcare mask leaves open.
+//! This expands far fewer nodes when the goal names only a few atoms and the start state names many.
+//! The returned plan and world states are in the same forward order as those of astar_plan().
+extern int astar_plan_regressive
+(
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Same as astar_plan_regressive(), but uses the caller's context instead of the shared one.
+extern int astar_plan_regressive_ctx
+(
+        astarcontext_t* ctx,            //!< search state, reused across calls, one per thread
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Same as astar_plan(), but searches forwards from the start and backwards from the goal at the same time, and joins the two halves where a state
+//! of the forward half satisfies a partial state of the backward half. The search ends when no plan cheaper than the best join can be left,
+//! so plans cost the same as those of astar_plan() with an admissible heuristic, while neither half has to search as deep.
+//! Each half may use the memory budget of the context.
+extern int astar_plan_bidirectional
+(
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Same as astar_plan_bidirectional(), but uses the caller's context instead of the shared one.
+extern int astar_plan_bidirectional_ctx
+(
+        astarcontext_t* ctx,            //!< search state, reused across calls, one per thread
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//! Same as astar_plan_ctx(), but with several goals, any of which will do. A single search finds the goal that is cheapest to reach once its offset is added,
+//! so that agents can weigh a few candidate goals in one go instead of planning for each. Goals with a lower offset are preferred: the plan to a goal
+//! wins over the plan to another goal if its cost plus offset is lower. Offsets must not be negative. Returns the cost of the plan, without the offset.
+extern int astar_plan_goals
+(
+        astarcontext_t* ctx,            //!< search state, reused across calls, one per thread
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        const worldstate_t* goals,      //!< the desired world states
+        const int* offsets,             //!< the offset of each goal, or null to make all offsets 0
+        int numgoals,                   //!< the nr of goals
+        int* reached,                   //!< for returning the index of the goal that the plan reaches, -1 if there is no plan
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+//!< The state that the workers of a parallel search share. For internal use by astar_plan_parallel().
+typedef struct astarparallel astarparallel_t;
+
+//! Prepare a parallel search over the contexts of numworkers workers, each of which stores the nodes whose world state hashes to it.
+//! The options of each context (heuristic, epsilon, prune, stubborn) must be set alike. Returns null if out of memory. For internal use by astar_plan_parallel().
+extern astarparallel_t* astar_parallel_begin( astarcontext_t** ctxs, int numworkers, actionplanner_t const* ap, worldstate_t start, worldstate_t goal );
+
+//! Run worker nr of a parallel search, until the search is over. Each worker must run on a thread of its own. For internal use by astar_plan_parallel().
+extern void astar_parallel_work( astarparallel_t* par, int nr );
+
+//! Finish a parallel search once all workers returned: get its plan, add up the statistics of all workers, and free the shared state.
+//! Returns the plan cost, ASTAR_NOPATH or ASTAR_OVERBUDGET. For internal use by astar_plan_parallel().
+extern int astar_parallel_end( astarparallel_t* par, astarstats_t* stats, const char** plan, worldstate_t* worldstates, int* plansize );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,67 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Atomic operations for the lock-free parts of the library, on GCC and Clang builtins or on the MSVC intrinsics.
+// All of them are sequentially consistent. The 32 bit ones work on int, the 64 bit ones on int64_t or uint64_t, the pointer ones on any pointer.
+// Compare and swap returns whether it swapped, and otherwise puts the value that it found in *expected.
+
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined( _MSC_VER ) && !defined( __clang__ )
+
+#include <intrin.h>
+
+static __forceinline bool goap_atomic_cas64_msvc( volatile __int64* p, __int64* expected, __int64 desired )
+{
+	const __int64 found = _InterlockedCompareExchange64( p, desired, *expected );
+	if ( found == *expected ) return true;
+	*expected = found;
+	return false;
+}
+
+static __forceinline bool goap_atomic_casptr_msvc( void* volatile* p, void** expected, void* desired )
+{
+	void* found = _InterlockedCompareExchangePointer( p, desired, *expected );
+	if ( found == *expected ) return true;
+	*expected = found;
+	return false;
+}
+
+#define goap_atomic_load32( p )			_InterlockedCompareExchange( (volatile long*)( p ), 0, 0 )
+#define goap_atomic_store32( p, v )		( (void)_InterlockedExchange( (volatile long*)( p ), (long)( v ) ) )
+#define goap_atomic_add32( p, v )		( _InterlockedExchangeAdd( (volatile long*)( p ), (long)( v ) ) + (long)( v ) )
+#define goap_atomic_load64( p )			_InterlockedCompareExchange64( (volatile __int64*)( p ), 0, 0 )
+#define goap_atomic_store64( p, v )		( (void)_InterlockedExchange64( (volatile __int64*)( p ), (__int64)( v ) ) )
+#define goap_atomic_add64( p, v )		( _InterlockedExchangeAdd64( (volatile __int64*)( p ), (__int64)( v ) ) + (__int64)( v ) )
+#define goap_atomic_cas64( p, e, v )		goap_atomic_cas64_msvc( (volatile __int64*)( p ), (__int64*)( e ), (__int64)( v ) )
+#define goap_atomic_loadptr( p )		_InterlockedCompareExchangePointer( (void* volatile*)( p ), 0, 0 )
+#define goap_atomic_exchangeptr( p, v )		_InterlockedExchangePointer( (void* volatile*)( p ), ( v ) )
+#define goap_atomic_casptr( p, e, v )		goap_atomic_casptr_msvc( (void* volatile*)( p ), (void**)( e ), ( v ) )
+
+#else
+
+#define goap_atomic_load32( p )			__atomic_load_n( p, __ATOMIC_SEQ_CST )
+#define goap_atomic_store32( p, v )		__atomic_store_n( p, v, __ATOMIC_SEQ_CST )
+#define goap_atomic_add32( p, v )		__atomic_add_fetch( p, v, __ATOMIC_SEQ_CST )
+#define goap_atomic_load64( p )			__atomic_load_n( p, __ATOMIC_SEQ_CST )
+#define goap_atomic_store64( p, v )		__atomic_store_n( p, v, __ATOMIC_SEQ_CST )
+#define goap_atomic_add64( p, v )		__atomic_add_fetch( p, v, __ATOMIC_SEQ_CST )
+#define goap_atomic_cas64( p, e, v )		__atomic_compare_exchange_n( p, e, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST )
+#define goap_atomic_loadptr( p )		__atomic_load_n( p, __ATOMIC_SEQ_CST )
+#define goap_atomic_exchangeptr( p, v )		__atomic_exchange_n( p, v, __ATOMIC_SEQ_CST )
+#define goap_atomic_casptr( p, e, v )		__atomic_compare_exchange_n( p, e, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST )
+
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#include "batch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+//!< The options of a search context, saved so that a parallel search can give them back.
+typedef struct
+{
+	int heuristic;			//!< The heuristic, one of ASTAR_H_*.
+	float epsilon;			//!< Nodes rank on g + (1+epsilon) * h.
+	bool prune;			//!< Leave out actions that cannot contribute to the goal?
+	bool stubborn;			//!< Expand only stubborn sets of actions?
+} searchoptions_t;
+
+
+//!< A thread in the pool, with the jobs it still has to do.
+typedef struct
+{
+	uint64_t range;			//!< Jobs not yet claimed, packed as ( end << 32 ) | begin. The owner claims from the front, thieves take the back half.
+	char pad[ 64 - sizeof( uint64_t ) ];	//!< Keep the range on its own cache line, as other threads poll it.
+	astarcontext_t ctx;		//!< The search context of this thread.
+	searchoptions_t saved;		//!< The options of ctx, while a parallel search sets its own.
+	pthread_t thread;		//!< The thread itself, unused for worker 0 which is the caller of astar_plan_batch().
+	astarpool_t* pool;		//!< The pool we belong to.
+	int nr;				//!< Our index in the pool.
+} worker_t;
+
+
+struct astarpool
+{
+	worker_t* workers;		//!< All workers, worker 0 being the thread that calls astar_plan_batch().
+	int numworkers;			//!< The nr of workers.
+	astarcontext_t** ctxs;		//!< The context of each worker.
+	void (*task)( worker_t* );	//!< What the workers should do: plan a batch, or take part in a parallel search.
+	astarjob_t* jobs;		//!< The batch being planned.
+	astarparallel_t* parallel;	//!< The parallel search being planned.
+	pthread_mutex_t lock;		//!< Protects generation, busy and quit.
+	pthread_cond_t wake;		//!< Signals the workers that a new batch is available, or that they should quit.
+	pthread_cond_t done;		//!< Signals the caller that all workers finished the batch.
+	unsigned int generation;	//!< Incremented for each batch.
+	int busy;			//!< The nr of workers still working on the batch.
+	bool quit;			//!< Set when the pool is destroyed.
+};
+
+
+static uint64_t pack_range( uint32_t begin, uint32_t end )
+{
+	return ( (uint64_t)end << 32 ) | begin;
+}
+
+
+//!< Internal function to claim the next job from our own range. Returns -1 if we have no jobs left.
+static int claim_own( worker_t* w )
+{
+	uint64_t r = __atomic_load_n( &w->range, __ATOMIC_ACQUIRE );
+	while ( true )
+	{
+		const uint32_t begin = (uint32_t)r;
+		const uint32_t end = (uint32_t)( r >> 32 );
+		if ( begin >= end ) return -1;
+		if ( __atomic_compare_exchange_n( &w->range, &r, pack_range( begin+1, end ), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+			return (int)begin;
+	}
+}
+
+
+//!< Internal function to steal the back half of the range of another worker. Returns the first stolen job, the rest becomes our own range. Returns -1 if nobody has jobs left.
+static int steal( worker_t* w )
+{
+	astarpool_t* pool = w->pool;
+	for ( int i=1; i<pool->numworkers; ++i )
+	{
+		worker_t* victim = pool->workers + ( w->nr + i ) % pool->numworkers;
+		uint64_t r = __atomic_load_n( &victim->range, __ATOMIC_ACQUIRE );
+		while ( true )
+		{
+			const uint32_t begin = (uint32_t)r;
+			const uint32_t end = (uint32_t)( r >> 32 );
+			if ( begin >= end ) break;
+			const uint32_t split = end - ( end - begin + 1 ) / 2;
+			if ( __atomic_compare_exchange_n( &victim->range, &r, pack_range( begin, split ), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+			{
+				__atomic_store_n( &w->range, pack_range( split+1, end ), __ATOMIC_RELEASE );
+				return (int)split;
+			}
+		}
+	}
+	return -1;
+}
+
+
+//!< Internal function that plans jobs until there are none left in the pool.
+static void plan_jobs( worker_t* w )
+{
+	astarjob_t* jobs = w->pool->jobs;
+	while ( true )
+	{
+		int j = claim_own( w );
+		if ( j < 0 ) j = steal( w );
+		if ( j < 0 ) return;
+		astarjob_t* job = jobs + j;
+		job->cost = job->overlay ?
+			astar_plan_overlay( &w->ctx, job->overlay, job->start, job->goal, job->plan, job->worldstates, &job->plansize ) :
+			astar_plan_ctx( &w->ctx, job->ap, job->start, job->goal, job->plan, job->worldstates, &job->plansize );
+	}
+}
+
+
+static void* worker_main( void* arg )
+{
+	worker_t* w = (worker_t*) arg;
+	astarpool_t* pool = w->pool;
+	unsigned int seen = 0;
+	pthread_mutex_lock( &pool->lock );
+	while ( true )
+	{
+		while ( !pool->quit && pool->generation == seen )
+			pthread_cond_wait( &pool->wake, &pool->lock );
+		if ( pool->quit ) break;
+		seen = pool->generation;
+		pthread_mutex_unlock( &pool->lock );
+		pool->task( w );
+		pthread_mutex_lock( &pool->lock );
+		if ( --pool->busy == 0 ) pthread_cond_signal( &pool->done );
+	}
+	pthread_mutex_unlock( &pool->lock );
+	return 0;
+}
+
+
+astarpool_t* astar_pool_create( int numthreads, size_t budget )
+{
+	if ( numthreads < 1 ) numthreads = 1;
+	astarpool_t* pool = (astarpool_t*) calloc( 1, sizeof( astarpool_t ) );
+	if ( !pool ) return 0;
+	pool->workers = (worker_t*) calloc( numthreads, sizeof( worker_t ) );
+	pool->ctxs = (astarcontext_t**) calloc( numthreads, sizeof( astarcontext_t* ) );
+	if ( !pool->workers || !pool->ctxs ) { free( pool->workers ); free( pool->ctxs ); free( pool ); return 0; }
+	pthread_mutex_init( &pool->lock, 0 );
+	pthread_cond_init( &pool->wake, 0 );
+	pthread_cond_init( &pool->done, 0 );
+	for ( int i=0; i<numthreads; ++i )
+	{
+		worker_t* w = pool->workers + i;
+		astar_context_init( &w->ctx );
+		w->ctx.budget = budget;
+		w->pool = pool;
+		w->nr = i;
+		pool->ctxs[ i ] = &w->ctx;
+		if ( i > 0 && pthread_create( &w->thread, 0, worker_main, w ) != 0 )
+		{
+			LOGE( "Could not start planner thread %d, continuing with %d threads.", i, i );
+			break;
+		}
+		pool->numworkers = i+1;
+	}
+	return pool;
+}
+
+
+void astar_pool_destroy( astarpool_t* pool )
+{
+	pthread_mutex_lock( &pool->lock );
+	pool->quit = true;
+	pthread_cond_broadcast( &pool->wake );
+	pthread_mutex_unlock( &pool->lock );
+	for ( int i=0; i<pool->numworkers; ++i )
+	{
+		if ( i > 0 ) pthread_join( pool->workers[ i ].thread, 0 );
+		astar_context_release( &pool->workers[ i ].ctx );
+	}
+	pthread_cond_destroy( &pool->done );
+	pthread_cond_destroy( &pool->wake );
+	pthread_mutex_destroy( &pool->lock );
+	free( pool->workers );
+	free( pool->ctxs );
+	free( pool );
+}
+
+
+//!< Internal function to run a task on all workers, the calling thread being worker 0, and to return when all of them are done.
+static void run_task( astarpool_t* pool, void (*task)( worker_t* ) )
+{
+	pthread_mutex_lock( &pool->lock );
+	pool->task = task;
+	pool->busy = pool->numworkers;
+	pool->generation++;
+	pthread_cond_broadcast( &pool->wake );
+	pthread_mutex_unlock( &pool->lock );
+
+	task( pool->workers );
+
+	pthread_mutex_lock( &pool->lock );
+	pool->busy--;
+	while ( pool->busy > 0 )
+		pthread_cond_wait( &pool->done, &pool->lock );
+	pthread_mutex_unlock( &pool->lock );
+}
+
+
+void astar_plan_batch( astarpool_t* pool, astarjob_t* jobs, int numjobs )
+{
+	// Hand out equal ranges to start with, stealing balances out the differences in search size.
+	const int n = pool->numworkers;
+	for ( int i=0; i<n; ++i )
+		pool->workers[ i ].range = pack_range( (uint32_t)( (int64_t)numjobs * i / n ), (uint32_t)( (int64_t)numjobs * ( i+1 ) / n ) );
+	pool->jobs = jobs;
+	run_task( pool, plan_jobs );
+}
+
+
+//!< Internal function that takes part in the parallel search of the pool.
+static void search_parallel( worker_t* w )
+{
+	astar_parallel_work( w->pool->parallel, w->nr );
+}
+
+
+int astar_plan_parallel
+(
+	astarpool_t* pool,
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	// the workers search with the options of ctx, and get their own back afterwards, for the batches that follow.
+	for ( int i=0; i<pool->numworkers; ++i )
+	{
+		worker_t* w = pool->workers + i;
+		w->saved = (searchoptions_t) { w->ctx.heuristic, w->ctx.epsilon, w->ctx.prune, w->ctx.stubborn };
+		w->ctx.heuristic = ctx ? ctx->heuristic : ASTAR_H_MISMATCH;
+		w->ctx.epsilon = ctx ? ctx->epsilon : 0.0f;
+		w->ctx.prune = ctx ? ctx->prune : false;
+		w->ctx.stubborn = ctx ? ctx->stubborn : false;
+	}
+	int result = ASTAR_OVERBUDGET;
+	astarstats_t stats;
+	memset( &stats, 0, sizeof( astarstats_t ) );
+	pool->parallel = astar_parallel_begin( pool->ctxs, pool->numworkers, ap, start, goal );
+	if ( pool->parallel )
+	{
+		run_task( pool, search_parallel );
+		result = astar_parallel_end( pool->parallel, &stats, plan, worldstates, plansize );
+		pool->parallel = 0;
+	}
+	for ( int i=0; i<pool->numworkers; ++i )
+	{
+		worker_t* w = pool->workers + i;
+		w->ctx.heuristic = w->saved.heuristic;
+		w->ctx.epsilon = w->saved.epsilon;
+		w->ctx.prune = w->saved.prune;
+		w->ctx.stubborn = w->saved.stubborn;
+	}
+	if ( ctx )
+	{
+		ctx->stats = stats;
+		ctx->status = result;
+		ctx->goalidx = -1;
+	}
+	return result;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "goap.h"
+#include "astar.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+//!< One planning request in a batch.
+typedef struct
+{
+	actionplanner_t const* ap;	//!< the goap action planner to use, may be shared by many jobs
+	const goapoverlay_t* overlay;	//!< if not null, plan for the agent of this overlay instead, and ignore ap
+	worldstate_t start;		//!< the current world state
+	worldstate_t goal;		//!< the desired world state
+	const char** plan;		//!< for returning all actions that make up plan
+	worldstate_t* worldstates;	//!< for returning intermediate world states
+	int plansize;			//!< in: size of plan buffer, out: size of plan (in nr of steps)
+	int cost;			//!< out: total cost of the plan, or ASTAR_NOPATH or ASTAR_OVERBUDGET
+} astarjob_t;
+
+
+//!< A set of worker threads, each with its own search context, that plans batches of jobs.
+typedef struct astarpool astarpool_t;
+
+
+//! Create a pool that plans on numthreads threads, including the thread that calls astar_plan_batch(). Each search may use budget bytes, 0 for ASTAR_DEFAULT_BUDGET.
+extern astarpool_t* astar_pool_create( int numthreads, size_t budget );
+
+//! Stop the worker threads and free the pool.
+extern void astar_pool_destroy( astarpool_t* pool );
+
+//! Plan all jobs, and return when they are done. Jobs are spread over the threads, and idle threads steal jobs from busy ones.
+//! Only one batch can run on a pool at a time.
+extern void astar_plan_batch( astarpool_t* pool, astarjob_t* jobs, int numjobs );
+
+//! Plan a single search on all threads of the pool, for a question too large for one thread. Returns the plan cost, ASTAR_NOPATH or ASTAR_OVERBUDGET.
+//! The world states are spread over the threads by their hash (HDA*), and each thread searches the states it owns, sending the others theirs.
+//! With an admissible heuristic, the plan is as cheap as that of astar_plan_ctx(), otherwise the cost returned is that of the actions of the plan returned.
+//! Each thread may use the budget of the pool. The batches that follow plan with the options of the pool again.
+//! Cannot run while a batch runs on the same pool.
+extern int astar_plan_parallel
+(
+        astarpool_t* pool,              //!< the threads to search on
+        astarcontext_t* ctx,            //!< heuristic, epsilon, prune and stubborn are taken from it, and stats and status are returned in it. May be null.
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,315 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Benchmark: plans random questions on seeded, randomly generated domains, and reports plans/sec, ns per expansion and peak node usage.
+// Without a size on the command line, it sweeps over a range of atom and action counts.
+
+#if !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE )
+#define _POSIX_C_SOURCE 199309L	// for clock_gettime()
+#endif
+
+#include "goap.h"	// for planner interface.
+#include "astar.h"	// for A* search over worldstate space.
+#include "batch.h"	// for parallel search.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+//!< The shape of a generated domain, and how to plan in it.
+typedef struct
+{
+	int numatoms;		//!< Nr of atoms in the world state.
+	int numactions;		//!< Nr of actions in the repertoire.
+	float predensity;	//!< Average nr of preconditions per action.
+	float effdensity;	//!< Average nr of effects per action. Each action has at least one.
+	int costspread;		//!< Action costs are drawn from 1 .. costspread.
+	int depth;		//!< Goals are found by a random walk of this many actions from the start.
+	int goalatoms;		//!< Max nr of atoms that a goal names.
+	int numplans;		//!< Nr of questions to plan per domain.
+	int heuristic;		//!< One of ASTAR_H_*.
+	int regressive;		//!< Search backwards from the goal?
+	int bidirectional;	//!< Search from start and goal at once?
+	int prune;		//!< Leave out actions that cannot contribute to the goal?
+	int stubborn;		//!< Expand only stubborn sets?
+	int threads;		//!< Search each question on this many threads, if more than 1.
+	uint64_t seed;		//!< Seed for the domain generator.
+} benchconfig_t;
+
+
+static char atomnames[ MAXATOMS ][ 8 ];
+static char actionnames[ MAXACTIONS ][ 8 ];
+
+
+//!< Random nr generator (splitmix64), so that a seed gives the same domains on all platforms.
+static uint64_t next_random( uint64_t* state )
+{
+	uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+	z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+	return z ^ ( z >> 31 );
+}
+
+
+static int random_below( uint64_t* state, int n )
+{
+	return (int)( next_random( state ) % (uint64_t)n );
+}
+
+
+static bool random_chance( uint64_t* state, float p )
+{
+	return ( next_random( state ) >> 40 ) < (uint64_t)( p * ( 1 << 24 ) );
+}
+
+
+static int64_t now_us( void )
+{
+#if defined( _WIN32 )
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency( &freq );
+	QueryPerformanceCounter( &count );
+	return (int64_t)( count.QuadPart * 1000000 / freq.QuadPart );
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+//!< Fill the planner with a random domain of the configured shape.
+static void generate_domain( const benchconfig_t* cfg, actionplanner_t* ap, uint64_t* rng )
+{
+	goap_actionplanner_clear( ap );
+	const float prechance = cfg->predensity / cfg->numatoms;
+	const float effchance = cfg->effdensity / cfg->numatoms;
+	for ( int i=0; i<cfg->numatoms; ++i )
+		goap_atom_idx( ap, atomnames[ i ] );
+	for ( int a=0; a<cfg->numactions; ++a )
+	{
+		const int act = goap_action_idx( ap, actionnames[ a ] );
+		bool haseffect = false;
+		for ( int i=0; i<cfg->numatoms; ++i )
+		{
+			if ( random_chance( rng, prechance ) )
+				goap_set_pre_idx( ap, act, i, random_chance( rng, 0.5f ) );
+			if ( random_chance( rng, effchance ) )
+			{
+				goap_set_pst_idx( ap, act, i, random_chance( rng, 0.5f ) );
+				haseffect = true;
+			}
+		}
+		if ( !haseffect )
+			goap_set_pst_idx( ap, act, random_below( rng, cfg->numatoms ), random_chance( rng, 0.5f ) );
+		goap_set_cost_idx( ap, act, 1 + random_below( rng, cfg->costspread ) );
+	}
+}
+
+
+//!< Make a random start state, and a goal that a random walk from the start reaches. Returns false if the walk got stuck right away.
+static bool generate_question( const benchconfig_t* cfg, const actionplanner_t* ap, uint64_t* rng, worldstate_t* start, worldstate_t* goal )
+{
+	goap_worldstate_clear( start );
+	for ( int i=0; i<cfg->numatoms; ++i )
+		goap_worldstate_set_idx( start, i, random_chance( rng, 0.5f ) );
+
+	worldstate_t cur = *start;
+	for ( int step=0; step<cfg->depth; ++step )
+	{
+		uint64_t applicable = goap_applicable_actions( &ap->act_table, cur.values );
+		if ( !applicable ) break;
+		int pick = random_below( rng, bfield_popcount64( applicable ) );
+		while ( pick-- ) applicable &= applicable - 1;
+		cur = goap_apply_action( &ap->act_table, bfield_ctz64( applicable ), cur );
+	}
+
+	// the goal names some of the atoms that the walk changed.
+	int changed[ MAXATOMS ];
+	int numchanged = 0;
+	for ( int i=0; i<cfg->numatoms; ++i )
+		if ( bfield_get( cur.values, i ) != bfield_get( start->values, i ) ) changed[ numchanged++ ] = i;
+	if ( !numchanged ) return false;
+	goap_worldstate_clear( goal );
+	for ( int k=0; k<cfg->goalatoms && numchanged>0; ++k )
+	{
+		const int pick = random_below( rng, numchanged );
+		goap_worldstate_set_idx( goal, changed[ pick ], bfield_get( cur.values, changed[ pick ] ) );
+		changed[ pick ] = changed[ --numchanged ];
+	}
+	return true;
+}
+
+
+//!< Plan all questions for one domain shape, and print a line with the results.
+static void run_config( const benchconfig_t* cfg, astarcontext_t* ctx, astarpool_t* pool )
+{
+	static actionplanner_t ap;
+	uint64_t rng = cfg->seed;
+	generate_domain( cfg, &ap, &rng );
+	ctx->heuristic = cfg->heuristic;
+	ctx->prune = cfg->prune;
+	ctx->stubborn = cfg->stubborn;
+
+	// generate the questions first, so that only planning is timed.
+	worldstate_t* starts = (worldstate_t*) malloc( cfg->numplans * sizeof( worldstate_t ) );
+	worldstate_t* goals = (worldstate_t*) malloc( cfg->numplans * sizeof( worldstate_t ) );
+	int numplans = 0;
+	for ( int q=0; q<cfg->numplans; ++q )
+		if ( generate_question( cfg, &ap, &rng, starts+numplans, goals+numplans ) ) numplans++;
+
+	int64_t expanded = 0;
+	int64_t plansteps = 0;
+	int peaknodes = 0;
+	int numfailed = 0;
+	const int64_t t0 = now_us();
+	for ( int q=0; q<numplans; ++q )
+	{
+		const char* plan[ 64 ];
+		worldstate_t states[ 64 ];
+		int plansz = 64;
+		const int cost = pool
+			? astar_plan_parallel( pool, ctx, &ap, starts[ q ], goals[ q ], plan, states, &plansz )
+			: cfg->bidirectional
+			? astar_plan_bidirectional_ctx( ctx, &ap, starts[ q ], goals[ q ], plan, states, &plansz )
+			: cfg->regressive
+			? astar_plan_regressive_ctx( ctx, &ap, starts[ q ], goals[ q ], plan, states, &plansz )
+			: astar_plan_ctx( ctx, &ap, starts[ q ], goals[ q ], plan, states, &plansz );
+		if ( cost < 0 ) numfailed++;
+		else plansteps += plansz;
+		expanded += ctx->stats.expanded;
+		// a parallel search stores its nodes with the threads of the pool, and a bidirectional one also in its backward half.
+		const int nodes = pool ? ctx->stats.generated : cfg->bidirectional ? ctx->numNodes + ctx->reverse->numNodes : ctx->numNodes;
+		if ( nodes > peaknodes ) peaknodes = nodes;
+	}
+	const int64_t totalus = now_us() - t0;
+	free( starts );
+	free( goals );
+
+	const double plans_per_sec = totalus ? numplans * 1e6 / totalus : 0.0;
+	const double ns_per_expansion = expanded ? totalus * 1e3 / expanded : 0.0;
+	printf( "%5d %7d %8d %7d %10.0f %10.1f %10.1f %7.1f %9d %8zu\n",
+		cfg->numatoms, cfg->numactions, numplans, numfailed, plans_per_sec,
+		numplans ? (double)expanded / numplans : 0.0, ns_per_expansion,
+		numplans > numfailed ? (double)plansteps / ( numplans - numfailed ) : 0.0,
+		peaknodes, peaknodes * ASTAR_NODE_BYTES / 1024 );
+}
+
+
+static void usage( const char* prog )
+{
+	printf( "Usage: %s [options]\n", prog );
+	printf( "  -atoms N      nr of atoms (default: sweep)\n" );
+	printf( "  -actions N    nr of actions (default: sweep)\n" );
+	printf( "  -pre N        average nr of preconditions per action (default 2)\n" );
+	printf( "  -eff N        average nr of effects per action (default 2)\n" );
+	printf( "  -costs N      costs range from 1 to N (default 4)\n" );
+	printf( "  -depth N      length of the random walk that finds a goal (default 8)\n" );
+	printf( "  -goal N       max nr of atoms in a goal (default 3)\n" );
+	printf( "  -plans N      nr of questions per domain (default 200)\n" );
+	printf( "  -heuristic NAME  mismatch, max or add (default mismatch)\n" );
+	printf( "  -regressive   search backwards from the goal\n" );
+	printf( "  -bidirectional search from the start and back from the goal at once\n" );
+	printf( "  -prune        leave out actions that cannot contribute to the goal\n" );
+	printf( "  -stubborn     expand only stubborn sets, to skip orderings of independent actions\n" );
+	printf( "  -threads N    search each question on N threads (default 1)\n" );
+	printf( "  -seed N       seed for the domain generator (default 1)\n" );
+}
+
+
+int main( int argc, char* argv[] )
+{
+	benchconfig_t cfg;
+	cfg.numatoms = 0;
+	cfg.numactions = 0;
+	cfg.predensity = 2.0f;
+	cfg.effdensity = 2.0f;
+	cfg.costspread = 4;
+	cfg.depth = 8;
+	cfg.goalatoms = 3;
+	cfg.numplans = 200;
+	cfg.heuristic = ASTAR_H_MISMATCH;
+	cfg.regressive = 0;
+	cfg.bidirectional = 0;
+	cfg.prune = 0;
+	cfg.stubborn = 0;
+	cfg.threads = 1;
+	cfg.seed = 1;
+
+	for ( int i=1; i<argc; ++i )
+	{
+		const char* arg = argv[ i ];
+		const char* val = i+1 < argc ? argv[ i+1 ] : 0;
+		if ( !strcmp( arg, "-regressive" ) ) { cfg.regressive = 1; continue; }
+		if ( !strcmp( arg, "-bidirectional" ) ) { cfg.bidirectional = 1; continue; }
+		if ( !strcmp( arg, "-prune" ) ) { cfg.prune = 1; continue; }
+		if ( !strcmp( arg, "-stubborn" ) ) { cfg.stubborn = 1; continue; }
+		if ( !strcmp( arg, "-h" ) || !strcmp( arg, "-help" ) ) { usage( argv[ 0 ] ); return 0; }
+		if ( !val ) { usage( argv[ 0 ] ); return 1; }
+		++i;
+		if      ( !strcmp( arg, "-atoms" ) )   cfg.numatoms = atoi( val );
+		else if ( !strcmp( arg, "-actions" ) ) cfg.numactions = atoi( val );
+		else if ( !strcmp( arg, "-pre" ) )     cfg.predensity = (float)atof( val );
+		else if ( !strcmp( arg, "-eff" ) )     cfg.effdensity = (float)atof( val );
+		else if ( !strcmp( arg, "-costs" ) )   cfg.costspread = atoi( val );
+		else if ( !strcmp( arg, "-depth" ) )   cfg.depth = atoi( val );
+		else if ( !strcmp( arg, "-goal" ) )    cfg.goalatoms = atoi( val );
+		else if ( !strcmp( arg, "-plans" ) )   cfg.numplans = atoi( val );
+		else if ( !strcmp( arg, "-seed" ) )    cfg.seed = strtoull( val, 0, 10 );
+		else if ( !strcmp( arg, "-threads" ) ) cfg.threads = atoi( val );
+		else if ( !strcmp( arg, "-heuristic" ) )
+		{
+			if      ( !strcmp( val, "mismatch" ) ) cfg.heuristic = ASTAR_H_MISMATCH;
+			else if ( !strcmp( val, "max" ) )      cfg.heuristic = ASTAR_H_MAX;
+			else if ( !strcmp( val, "add" ) )      cfg.heuristic = ASTAR_H_ADD;
+			else { usage( argv[ 0 ] ); return 1; }
+		}
+		else { usage( argv[ 0 ] ); return 1; }
+	}
+	if ( cfg.numatoms > MAXATOMS || cfg.numactions > MAXACTIONS || cfg.costspread < 1 || cfg.numatoms < 0 || cfg.numactions < 0 )
+	{
+		printf( "At most %d atoms and %d actions, and costs of at least 1.\n", MAXATOMS, MAXACTIONS );
+		return 1;
+	}
+
+	for ( int i=0; i<MAXATOMS; ++i ) snprintf( atomnames[ i ], sizeof( atomnames[ i ] ), "a%d", i );
+	for ( int i=0; i<MAXACTIONS; ++i ) snprintf( actionnames[ i ], sizeof( actionnames[ i ] ), "x%d", i );
+
+	static const int sweepatoms[] = { 16, 32, 64, 128, 256, 512 };
+	static const int sweepactions[] = { 16, 32, 64 };
+	astarcontext_t ctx;
+	astar_context_init( &ctx );
+	ctx.budget = 64 << 20;
+	astarpool_t* pool = cfg.threads > 1 ? astar_pool_create( cfg.threads, ctx.budget ) : 0;
+
+	printf( "atoms actions    plans  failed  plans/sec  exp/plan    ns/exp  steps  peaknodes  peak-KB\n" );
+	for ( size_t i=0; i<sizeof( sweepatoms ) / sizeof( sweepatoms[ 0 ] ); ++i )
+	{
+		if ( cfg.numatoms && sweepatoms[ i ] != sweepatoms[ 0 ] ) break;
+		for ( size_t j=0; j<sizeof( sweepactions ) / sizeof( sweepactions[ 0 ] ); ++j )
+		{
+			if ( cfg.numactions && sweepactions[ j ] != sweepactions[ 0 ] ) break;
+			benchconfig_t c = cfg;
+			if ( !c.numatoms ) c.numatoms = sweepatoms[ i ];
+			if ( !c.numactions ) c.numactions = sweepactions[ j ];
+			if ( c.numatoms > MAXATOMS ) continue;
+			run_config( &c, &ctx, pool );
+		}
+	}
+	if ( pool ) astar_pool_destroy( pool );
+	astar_context_release( &ctx );
+	return 0;
+}
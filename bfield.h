@@ -0,0 +1,300 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Bit fields that hold one bit per world state atom.
+// By default a bit field is a single 64 bit integer. Build everything (library and users alike) with -DGOAP_WORDS=2, 4 or 8
+// to get 128, 256 or 512 atoms. Wide bit fields use SSE2 or AVX2 when the compiler targets them.
+
+#ifndef BFIELD_H
+#define BFIELD_H
+
+#ifdef __cplusplus
+#include <cstdbool>
+#include <cstdint>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#ifndef GOAP_WORDS
+#define GOAP_WORDS 1	//!< The nr of 64 bit words in a bit field.
+#endif
+
+#if GOAP_WORDS != 1 && GOAP_WORDS != 2 && GOAP_WORDS != 4 && GOAP_WORDS != 8
+#error "GOAP_WORDS must be 1, 2, 4 or 8."
+#endif
+
+#if GOAP_WORDS > 1
+#	if defined( __AVX2__ ) && GOAP_WORDS >= 4
+#		include <immintrin.h>
+#		define BFIELD_AVX2
+#	elif defined( __SSE2__ ) || defined( _M_X64 )
+#		include <emmintrin.h>
+#		define BFIELD_SSE2
+#	endif
+#endif
+
+#if defined( _MSC_VER ) && !defined( __clang__ )
+#	include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#if GOAP_WORDS == 1
+typedef int64_t bfield_t;
+#else
+typedef struct
+{
+	uint64_t w[ GOAP_WORDS ];
+} bfield_t;
+#endif
+
+
+//!< Count the set bits in a word.
+static inline int bfield_popcount64( uint64_t x )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+	return __builtin_popcountll( x );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+	return (int) __popcnt64( x );
+#else
+	x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+	x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+	x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int) ( ( x * 0x0101010101010101ULL ) >> 56 );
+#endif
+}
+
+
+//!< Find the lowest set bit in a word that is not zero.
+static inline int bfield_ctz64( uint64_t x )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+	return __builtin_ctzll( x );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+	unsigned long idx;
+	_BitScanForward64( &idx, x );
+	return (int) idx;
+#else
+	return bfield_popcount64( ( x & -x ) - 1 );
+#endif
+}
+
+
+//!< Get word i of a bit field.
+static inline uint64_t bfield_word( bfield_t b, int i )
+{
+#if GOAP_WORDS == 1
+	(void) i;
+	return (uint64_t) b;
+#else
+	return b.w[ i ];
+#endif
+}
+
+
+//!< Set word i of a bit field.
+static inline void bfield_setword( bfield_t* b, int i, uint64_t w )
+{
+#if GOAP_WORDS == 1
+	(void) i;
+	*b = (bfield_t) w;
+#else
+	b->w[ i ] = w;
+#endif
+}
+
+
+//!< A bit field with all bits cleared.
+static inline bfield_t bfield_zero( void )
+{
+#if GOAP_WORDS == 1
+	return 0LL;
+#else
+	bfield_t r;
+	for ( int i=0; i<GOAP_WORDS; ++i ) r.w[ i ] = 0ULL;
+	return r;
+#endif
+}
+
+
+//!< A bit field with all bits set.
+static inline bfield_t bfield_ones( void )
+{
+#if GOAP_WORDS == 1
+	return -1LL;
+#else
+	bfield_t r;
+	for ( int i=0; i<GOAP_WORDS; ++i ) r.w[ i ] = ~0ULL;
+	return r;
+#endif
+}
+
+
+//!< Get the bit for atom idx.
+static inline bool bfield_get( bfield_t b, int idx )
+{
+#if GOAP_WORDS == 1
+	return ( ( (uint64_t)b >> idx ) & 1ULL ) != 0;
+#else
+	return ( ( b.w[ idx >> 6 ] >> ( idx & 63 ) ) & 1ULL ) != 0;
+#endif
+}
+
+
+//!< Set the bit for atom idx to value.
+static inline void bfield_set( bfield_t* b, int idx, bool value )
+{
+#if GOAP_WORDS == 1
+	const uint64_t bit = 1ULL << idx;
+	*b = (bfield_t) ( value ? ( (uint64_t)*b | bit ) : ( (uint64_t)*b & ~bit ) );
+#else
+	const uint64_t bit = 1ULL << ( idx & 63 );
+	uint64_t* w = b->w + ( idx >> 6 );
+	*w = value ? ( *w | bit ) : ( *w & ~bit );
+#endif
+}
+
+
+//!< Are a and b the same?
+static inline bool bfield_equal( bfield_t a, bfield_t b )
+{
+#if GOAP_WORDS == 1
+	return a == b;
+#elif defined( BFIELD_AVX2 )
+	__m256i diff = _mm256_setzero_si256();
+	for ( int i=0; i<GOAP_WORDS; i+=4 )
+		diff = _mm256_or_si256( diff, _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)( a.w+i ) ), _mm256_loadu_si256( (const __m256i*)( b.w+i ) ) ) );
+	return _mm256_testz_si256( diff, diff ) != 0;
+#elif defined( BFIELD_SSE2 )
+	__m128i diff = _mm_setzero_si128();
+	for ( int i=0; i<GOAP_WORDS; i+=2 )
+		diff = _mm_or_si128( diff, _mm_xor_si128( _mm_loadu_si128( (const __m128i*)( a.w+i ) ), _mm_loadu_si128( (const __m128i*)( b.w+i ) ) ) );
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( diff, _mm_setzero_si128() ) ) == 0xffff;
+#else
+	uint64_t diff = 0;
+	for ( int i=0; i<GOAP_WORDS; ++i ) diff |= a.w[ i ] ^ b.w[ i ];
+	return diff == 0;
+#endif
+}
+
+
+//!< Do a and b agree on all bits that are not in dontcare? This is the precondition and goal test.
+static inline bool bfield_match( bfield_t a, bfield_t b, bfield_t dontcare )
+{
+#if GOAP_WORDS == 1
+	return ( ( a ^ b ) & ~dontcare ) == 0;
+#elif defined( BFIELD_AVX2 )
+	__m256i diff = _mm256_setzero_si256();
+	for ( int i=0; i<GOAP_WORDS; i+=4 )
+	{
+		const __m256i x = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)( a.w+i ) ), _mm256_loadu_si256( (const __m256i*)( b.w+i ) ) );
+		diff = _mm256_or_si256( diff, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i*)( dontcare.w+i ) ), x ) );
+	}
+	return _mm256_testz_si256( diff, diff ) != 0;
+#elif defined( BFIELD_SSE2 )
+	__m128i diff = _mm_setzero_si128();
+	for ( int i=0; i<GOAP_WORDS; i+=2 )
+	{
+		const __m128i x = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)( a.w+i ) ), _mm_loadu_si128( (const __m128i*)( b.w+i ) ) );
+		diff = _mm_or_si128( diff, _mm_andnot_si128( _mm_loadu_si128( (const __m128i*)( dontcare.w+i ) ), x ) );
+	}
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( diff, _mm_setzero_si128() ) ) == 0xffff;
+#else
+	uint64_t diff = 0;
+	for ( int i=0; i<GOAP_WORDS; ++i ) diff |= ( a.w[ i ] ^ b.w[ i ] ) & ~dontcare.w[ i ];
+	return diff == 0;
+#endif
+}
+
+
+//!< Count the bits that are not in dontcare, on which a and b disagree.
+static inline int bfield_mismatch( bfield_t a, bfield_t b, bfield_t dontcare )
+{
+#if GOAP_WORDS == 1
+	return bfield_popcount64( (uint64_t)( ( a ^ b ) & ~dontcare ) );
+#else
+	int dist = 0;
+	for ( int i=0; i<GOAP_WORDS; ++i ) dist += bfield_popcount64( ( a.w[ i ] ^ b.w[ i ] ) & ~dontcare.w[ i ] );
+	return dist;
+#endif
+}
+
+
+//!< Overwrite the bits of a that are not in dontcare, with those of b. This applies action effects.
+static inline bfield_t bfield_assign( bfield_t a, bfield_t b, bfield_t dontcare )
+{
+#if GOAP_WORDS == 1
+	return ( a & dontcare ) | ( b & ~dontcare );
+#else
+	bfield_t r;
+#	if defined( BFIELD_AVX2 )
+	for ( int i=0; i<GOAP_WORDS; i+=4 )
+	{
+		const __m256i d = _mm256_loadu_si256( (const __m256i*)( dontcare.w+i ) );
+		const __m256i x = _mm256_or_si256( _mm256_and_si256( d, _mm256_loadu_si256( (const __m256i*)( a.w+i ) ) ), _mm256_andnot_si256( d, _mm256_loadu_si256( (const __m256i*)( b.w+i ) ) ) );
+		_mm256_storeu_si256( (__m256i*)( r.w+i ), x );
+	}
+#	elif defined( BFIELD_SSE2 )
+	for ( int i=0; i<GOAP_WORDS; i+=2 )
+	{
+		const __m128i d = _mm_loadu_si128( (const __m128i*)( dontcare.w+i ) );
+		const __m128i x = _mm_or_si128( _mm_and_si128( d, _mm_loadu_si128( (const __m128i*)( a.w+i ) ) ), _mm_andnot_si128( d, _mm_loadu_si128( (const __m128i*)( b.w+i ) ) ) );
+		_mm_storeu_si128( (__m128i*)( r.w+i ), x );
+	}
+#	else
+	for ( int i=0; i<GOAP_WORDS; ++i ) r.w[ i ] = ( a.w[ i ] & dontcare.w[ i ] ) | ( b.w[ i ] & ~dontcare.w[ i ] );
+#	endif
+	return r;
+#endif
+}
+
+
+//!< Bits that are set in both a and b.
+static inline bfield_t bfield_and( bfield_t a, bfield_t b )
+{
+#if GOAP_WORDS == 1
+	return a & b;
+#else
+	for ( int i=0; i<GOAP_WORDS; ++i ) a.w[ i ] &= b.w[ i ];
+	return a;
+#endif
+}
+
+
+//!< Scramble the bits of a bit field into a hash value, so that similar bit fields end up far apart (splitmix64 finalizer).
+static inline uint64_t bfield_hash( bfield_t b )
+{
+#if GOAP_WORDS == 1
+	uint64_t z = (uint64_t)b + 0x9e3779b97f4a7c15ULL;
+	z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+	return z ^ ( z >> 31 );
+#else
+	uint64_t h = 0;
+	for ( int i=0; i<GOAP_WORDS; ++i )
+	{
+		uint64_t z = ( h ^ b.w[ i ] ) + 0x9e3779b97f4a7c15ULL;
+		z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+		z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+		h = z ^ ( z >> 31 );
+	}
+	return h;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
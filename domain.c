@@ -0,0 +1,232 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#if !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE )
+#define _POSIX_C_SOURCE 200112L	// for mmap() and fstat()
+#endif
+
+#include "domain.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined( _WIN32 )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+//!< The start of a compiled domain file. It is followed by the planner, as laid out in memory, and then by the names.
+typedef struct
+{
+	char magic[ 8 ];			//!< "GPGOAPD", to recognize the file.
+	uint32_t format;			//!< GOAP_DOMAIN_FORMAT of the build that wrote the file.
+	uint32_t words;				//!< GOAP_WORDS of the build that wrote the file.
+	uint32_t plannerbytes;			//!< The size of actionplanner_t in the build that wrote the file.
+	uint32_t filebytes;			//!< The size of the whole file.
+	uint32_t atm_names[ MAXATOMS ];		//!< Offset in the file of each atom name.
+	uint32_t act_names[ MAXACTIONS ];	//!< Offset in the file of each action name.
+} domainheader_t;
+
+static const char magic[ 8 ] = "GPGOAPD";
+
+#define PLANNER_OFFSET ( ( sizeof( domainheader_t ) + 63 ) & ~(size_t)63 )	//!< Where the planner starts in the file, aligned so that it can be used where it is mapped.
+
+
+//!< Internal function to report a parse error, if the caller wants it.
+static bool parse_error( char* err, int errsz, int line, const char* msg, const char* token )
+{
+	if ( err && errsz > 0 )
+		snprintf( err, errsz, "line %d: %s%s%s", line, msg, token ? ": " : "", token ? token : "" );
+	return false;
+}
+
+
+//!< Internal function to cut the next token out of a line, in place. Returns null at the end of the line, or at a comment.
+static char* next_token( char** cursor )
+{
+	char* s = *cursor;
+	while ( *s == ' ' || *s == '\t' || *s == '\r' ) ++s;
+	if ( *s == '\0' || *s == '#' ) { *s = '\0'; *cursor = s; return 0; }
+	char* token = s;
+	while ( *s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '#' ) ++s;
+	if ( *s == ' ' || *s == '\t' || *s == '\r' ) *s++ = '\0';
+	else if ( *s == '#' ) *s = '\0';
+	*cursor = s;
+	return token;
+}
+
+
+bool goap_parse_domain( actionplanner_t* ap, char* text, char* err, int errsz )
+{
+	if ( ap->frozen ) return parse_error( err, errsz, 0, "planner is frozen", 0 );
+	const char* action = 0;
+	int linenr = 0;
+	for ( char* line = text; line; )
+	{
+		++linenr;
+		char* eol = strchr( line, '\n' );
+		if ( eol ) *eol = '\0';
+		char* cursor = line;
+		line = eol ? eol + 1 : 0;
+
+		const char* keyword = next_token( &cursor );
+		if ( !keyword ) continue;
+		const char* arg = next_token( &cursor );
+		const char* val = arg ? next_token( &cursor ) : 0;
+		const char* extra = val ? next_token( &cursor ) : 0;
+		if ( !arg ) return parse_error( err, errsz, linenr, "missing argument for", keyword );
+		if ( extra ) return parse_error( err, errsz, linenr, "unexpected", extra );
+
+		if ( !strcmp( keyword, "atom" ) || !strcmp( keyword, "action" ) )
+		{
+			if ( val ) return parse_error( err, errsz, linenr, "unexpected", val );
+			const bool isatom = keyword[ 1 ] == 't';
+			const int idx = isatom ? goap_atom_idx( ap, arg ) : goap_action_idx( ap, arg );
+			if ( idx < 0 ) return parse_error( err, errsz, linenr, isatom ? "too many atoms" : "too many actions", arg );
+			if ( !isatom ) action = arg;
+		}
+		else if ( !strcmp( keyword, "pre" ) || !strcmp( keyword, "pst" ) )
+		{
+			if ( !action ) return parse_error( err, errsz, linenr, "condition outside of an action", arg );
+			if ( !val ) return parse_error( err, errsz, linenr, "missing value for", arg );
+			bool value;
+			if ( !strcmp( val, "true" ) || !strcmp( val, "1" ) ) value = true;
+			else if ( !strcmp( val, "false" ) || !strcmp( val, "0" ) ) value = false;
+			else return parse_error( err, errsz, linenr, "value is not true or false", val );
+			const bool added = keyword[ 1 ] == 'r' ? goap_set_pre( ap, action, arg, value ) : goap_set_pst( ap, action, arg, value );
+			if ( !added ) return parse_error( err, errsz, linenr, "too many atoms", arg );
+		}
+		else if ( !strcmp( keyword, "cost" ) )
+		{
+			if ( !action ) return parse_error( err, errsz, linenr, "cost outside of an action", arg );
+			if ( val ) return parse_error( err, errsz, linenr, "unexpected", val );
+			char* end;
+			const long cost = strtol( arg, &end, 10 );
+			if ( *end || cost < 0 || cost > 0xffff ) return parse_error( err, errsz, linenr, "cost is not a number from 0 to 65535", arg );
+			goap_set_cost( ap, action, (int)cost );
+		}
+		else return parse_error( err, errsz, linenr, "unknown keyword", keyword );
+	}
+	return true;
+}
+
+
+bool goap_write_domain( actionplanner_t const* ap, const char* path )
+{
+	size_t filebytes = PLANNER_OFFSET + sizeof( actionplanner_t );
+	for ( int i=0; i<ap->numatoms; ++i ) filebytes += strlen( ap->atm_names[ i ] ) + 1;
+	for ( int i=0; i<ap->numactions; ++i ) filebytes += strlen( ap->act_names[ i ] ) + 1;
+	char* buf = (char*) calloc( 1, filebytes );
+	if ( !buf ) return false;
+
+	domainheader_t* hdr = (domainheader_t*) buf;
+	memcpy( hdr->magic, magic, sizeof( magic ) );
+	hdr->format = GOAP_DOMAIN_FORMAT;
+	hdr->words = GOAP_WORDS;
+	hdr->plannerbytes = sizeof( actionplanner_t );
+	hdr->filebytes = (uint32_t) filebytes;
+
+	// the names are stored after the planner, and the planner only keeps their offsets in the header.
+	actionplanner_t* image = (actionplanner_t*) ( buf + PLANNER_OFFSET );
+	memcpy( image, ap, sizeof( actionplanner_t ) );
+	size_t offset = PLANNER_OFFSET + sizeof( actionplanner_t );
+	for ( int i=0; i<ap->numatoms; ++i )
+	{
+		const size_t len = strlen( ap->atm_names[ i ] ) + 1;
+		memcpy( buf + offset, ap->atm_names[ i ], len );
+		hdr->atm_names[ i ] = (uint32_t) offset;
+		image->atm_names[ i ] = 0;
+		offset += len;
+	}
+	for ( int i=0; i<ap->numactions; ++i )
+	{
+		const size_t len = strlen( ap->act_names[ i ] ) + 1;
+		memcpy( buf + offset, ap->act_names[ i ], len );
+		hdr->act_names[ i ] = (uint32_t) offset;
+		image->act_names[ i ] = 0;
+		offset += len;
+	}
+	image->frozen = true;
+
+	FILE* f = fopen( path, "wb" );
+	bool written = f && fwrite( buf, 1, filebytes, f ) == filebytes;
+	if ( f && fclose( f ) != 0 ) written = false;
+	free( buf );
+	return written;
+}
+
+
+//!< Internal function to check that a mapped file is a compiled domain for this build, with all names inside the file.
+static bool valid_domain( const char* base, size_t size )
+{
+	const domainheader_t* hdr = (const domainheader_t*) base;
+	if ( size < PLANNER_OFFSET + sizeof( actionplanner_t ) ) return false;
+	if ( memcmp( hdr->magic, magic, sizeof( magic ) ) || hdr->format != GOAP_DOMAIN_FORMAT ) return false;
+	if ( hdr->words != GOAP_WORDS || hdr->plannerbytes != sizeof( actionplanner_t ) || hdr->filebytes != size ) return false;
+	if ( base[ size-1 ] != '\0' ) return false;
+	const actionplanner_t* ap = (const actionplanner_t*) ( base + PLANNER_OFFSET );
+	if ( ap->numatoms < 0 || ap->numatoms > MAXATOMS || ap->numactions < 0 || ap->numactions > MAXACTIONS ) return false;
+	const uint32_t first = (uint32_t)( PLANNER_OFFSET + sizeof( actionplanner_t ) );
+	for ( int i=0; i<ap->numatoms; ++i )
+		if ( hdr->atm_names[ i ] < first || hdr->atm_names[ i ] >= size ) return false;
+	for ( int i=0; i<ap->numactions; ++i )
+		if ( hdr->act_names[ i ] < first || hdr->act_names[ i ] >= size ) return false;
+	return true;
+}
+
+
+actionplanner_t* goap_map_domain( const char* path )
+{
+#if defined( _WIN32 )
+	// no mmap(): read the file instead, which still needs no parsing.
+	FILE* f = fopen( path, "rb" );
+	if ( !f ) return 0;
+	fseek( f, 0, SEEK_END );
+	const long size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	char* base = size > 0 ? (char*) malloc( size ) : 0;
+	const bool read = base && fread( base, 1, size, f ) == (size_t) size;
+	fclose( f );
+	if ( !read || !valid_domain( base, size ) ) { free( base ); return 0; }
+#else
+	const int fd = open( path, O_RDONLY );
+	if ( fd < 0 ) return 0;
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size <= 0 ) { close( fd ); return 0; }
+	const size_t size = (size_t) st.st_size;
+	// a private mapping, so that setting the name pointers only copies the pages that hold them, and never touches the file.
+	void* mapped = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( mapped == MAP_FAILED ) return 0;
+	char* base = (char*) mapped;
+	if ( !valid_domain( base, size ) ) { munmap( mapped, size ); return 0; }
+#endif
+	const domainheader_t* hdr = (const domainheader_t*) base;
+	actionplanner_t* ap = (actionplanner_t*) ( base + PLANNER_OFFSET );
+	for ( int i=0; i<ap->numatoms; ++i ) ap->atm_names[ i ] = base + hdr->atm_names[ i ];
+	for ( int i=0; i<ap->numactions; ++i ) ap->act_names[ i ] = base + hdr->act_names[ i ];
+	ap->frozen = true;
+	return ap;
+}
+
+
+void goap_unmap_domain( actionplanner_t* ap )
+{
+	if ( !ap ) return;
+	char* base = (char*) ap - PLANNER_OFFSET;
+#if defined( _WIN32 )
+	free( base );
+#else
+	munmap( base, ( (const domainheader_t*) base )->filebytes );
+#endif
+}
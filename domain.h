@@ -0,0 +1,53 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include "goap.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#define GOAP_DOMAIN_FORMAT 2	//!< Version of the compiled domain format. Files of another version are refused.
+
+
+//! Add the atoms and actions described by a text domain to the planner. The text is parsed in place: names are cut out of it,
+//! and the planner points to them, so the text must stay around as long as the planner does. The format is line based:
+//!
+//!	# comments run to the end of the line
+//!	atom armedwithgun		declares an atom, so that atoms get their indices in this order (optional)
+//!	action scout			starts an action, which the lines below it describe
+//!	pre armedwithgun true		adds a precondition, with value true or false
+//!	pst enemyvisible true		adds a postcondition, with value true or false
+//!	cost 2				sets the cost, which is 1 if not given
+//!
+//! Returns false if the text is malformed, or if the planner has no room, or is frozen. If err is not null, it receives a message with the line nr.
+extern bool goap_parse_domain( actionplanner_t* ap, char* text, char* err, int errsz );
+
+//! Write the planner to a compiled domain file, which goap_map_domain() can load without parsing. Returns false if the file cannot be written.
+//! The file holds the planner as it is laid out in memory, so it can only be read by a build with the same GOAP_WORDS, on the same platform.
+extern bool goap_write_domain( actionplanner_t const* ap, const char* path );
+
+//! Map a compiled domain file into memory, and return the planner that it holds, frozen, or null if the file is missing or does not match this build.
+//! Nothing is parsed or copied: the planner and its names are used where they are mapped, so loading is about as fast as opening the file.
+//! Give agents overlays on it (see goap_overlay_init()), and release it with goap_unmap_domain() when no agent uses it anymore.
+extern actionplanner_t* goap_map_domain( const char* path );
+
+//! Release a planner that goap_map_domain() returned.
+extern void goap_unmap_domain( actionplanner_t* ap );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
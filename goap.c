@@ -19,17 +19,44 @@ Unless required by applicable law or agreed to in writing, software distributed
 #include <string.h>
 #include <stdio.h>
 
+#if defined( __AVX2__ )
+#	include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+#	include <emmintrin.h>
+#endif
+
+
+//!< Hash a name (FNV-1a), to find its slot in a name index.
+static uint32_t hash_name( const char* name )
+{
+	uint32_t h = 2166136261u;
+	while ( *name )
+		h = ( h ^ (uint8_t) *name++ ) * 16777619u;
+	return h;
+}
+
+
+//!< Find the slot for a name in a name index. The slot holds the index of the name, or is empty (-1) if the name is not known yet.
+static int16_t* slot_for_name( int16_t* hash, int hashsize, const char* const* names, const char* name )
+{
+	uint32_t h = hash_name( name ) & ( hashsize - 1 );
+	while ( hash[ h ] != -1 && strcmp( names[ hash[ h ] ], name ) )
+		h = ( h + 1 ) & ( hashsize - 1 );
+	return hash + h;
+}
+
 
 static int idx_for_atomname( actionplanner_t* ap, const char* atomname )
 {
-	int idx;
-	for ( idx=0; idx < ap->numatoms; ++idx )
-		if ( !strcmp( ap->atm_names[ idx ], atomname ) ) return idx;
+	int16_t* slot = slot_for_name( ap->atm_hash, 2*MAXATOMS, ap->atm_names, atomname );
+	if ( *slot != -1 || ap->frozen ) return *slot;
 
+	const int idx = ap->numatoms;
 	if ( idx < MAXATOMS )
 	{
 		ap->atm_names[ idx ] = atomname;
 		ap->numatoms++;
+		*slot = idx;
 		return idx;
 	}
 
@@ -39,15 +66,17 @@ static int idx_for_atomname( actionplanner_t* ap, const char* atomname )
 
 static int idx_for_actionname( actionplanner_t* ap, const char* actionname )
 {
-	int idx;
-	for ( idx=0; idx < ap->numactions; ++idx )
-		if ( !strcmp( ap->act_names[ idx ], actionname ) ) return idx;
+	int16_t* slot = slot_for_name( ap->act_hash, 2*MAXACTIONS, ap->act_names, actionname );
+	if ( *slot != -1 || ap->frozen ) return *slot;
 
+	const int idx = ap->numactions;
 	if ( idx < MAXACTIONS )
 	{
 		ap->act_names[ idx ] = actionname;
 		ap->act_costs[ idx ] = 1; // default cost is 1
 		ap->numactions++;
+		ap->act_table.numactions = ap->numactions;
+		*slot = idx;
 		return idx;
 	}
 
@@ -55,6 +84,47 @@ static int idx_for_actionname( actionplanner_t* ap, const char* actionname )
 }
 
 
+//!< Copy the conditions of an action into the compiled action table.
+static void compile_action( actionplanner_t* ap, int actidx )
+{
+	actiontable_t* table = &ap->act_table;
+	const worldstate_t pre = ap->act_pre[ actidx ];
+	const worldstate_t pst = ap->act_pst[ actidx ];
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		table->pre_care[ w ][ actidx ] = ~bfield_word( pre.dontcare, w );
+		table->pre_values[ w ][ actidx ] = bfield_word( pre.values, w ) & table->pre_care[ w ][ actidx ];
+		table->pst_care[ w ][ actidx ] = ~bfield_word( pst.dontcare, w );
+		table->pst_values[ w ][ actidx ] = bfield_word( pst.values, w ) & table->pst_care[ w ][ actidx ];
+	}
+
+	// which literals does the action achieve?
+	const uint64_t bit = 1ULL << actidx;
+	for ( int i=0; i<MAXATOMS; ++i )
+	{
+		const bool affected = !bfield_get( pst.dontcare, i );
+		const int v = bfield_get( pst.values, i );
+		table->achievers[ v ][ i ] = affected ? ( table->achievers[ v ][ i ] | bit ) : ( table->achievers[ v ][ i ] & ~bit );
+		table->achievers[ !v ][ i ] &= ~bit;
+	}
+
+	// which actions does it interfere with? Unused entries have no conditions, so they interfere with nothing.
+	for ( int other=0; other<MAXACTIONS; ++other )
+	{
+		uint64_t clash = 0;
+		for ( int w=0; w<GOAP_WORDS && other!=actidx; ++w )
+		{
+			clash |= table->pst_care[ w ][ actidx ] & table->pre_care[ w ][ other ] & ( table->pst_values[ w ][ actidx ] ^ table->pre_values[ w ][ other ] );
+			clash |= table->pst_care[ w ][ other ] & table->pre_care[ w ][ actidx ] & ( table->pst_values[ w ][ other ] ^ table->pre_values[ w ][ actidx ] );
+			clash |= table->pst_care[ w ][ actidx ] & table->pst_care[ w ][ other ] & ( table->pst_values[ w ][ actidx ] ^ table->pst_values[ w ][ other ] );
+		}
+		const uint64_t otherbit = 1ULL << other;
+		table->interferes[ actidx ] = clash ? ( table->interferes[ actidx ] | otherbit ) : ( table->interferes[ actidx ] & ~otherbit );
+		table->interferes[ other ] = clash ? ( table->interferes[ other ] | bit ) : ( table->interferes[ other ] & ~bit );
+	}
+}
+
+
 void goap_actionplanner_clear( actionplanner_t* ap )
 {
 	ap->numatoms = 0;
@@ -70,13 +140,18 @@ void goap_actionplanner_clear( actionplanner_t* ap )
 		goap_worldstate_clear( ap->act_pre+i );
 		goap_worldstate_clear( ap->act_pst+i );
 	}
+	memset( &ap->act_table, 0, sizeof( ap->act_table ) );
+	memset( ap->atm_hash, 0xff, sizeof( ap->atm_hash ) );
+	memset( ap->act_hash, 0xff, sizeof( ap->act_hash ) );
+	ap->frozen = false;
+	ap->version++;	// not reset: a planner that is cleared and refilled must not look like its old self.
 }
 
 
 void goap_worldstate_clear( worldstate_t* ws )
 {
-	ws->values = 0LL;
-	ws->dontcare = -1LL;
+	ws->values = bfield_zero();
+	ws->dontcare = bfield_ones();
 }
 
 
@@ -84,20 +159,36 @@ bool goap_worldstate_set( actionplanner_t* ap, worldstate_t* ws, const char* ato
 {
 	const int idx = idx_for_atomname( ap, atomname );
 	if ( idx == -1 ) return false;
-	ws->values = value ? ( ws->values | ( 1LL << idx ) ) : ( ws->values & ~( 1LL << idx ) );
-	ws->dontcare &= ~( 1LL << idx );
+	goap_worldstate_set_idx( ws, idx, value );
 	return true;
 }
 
 
+int goap_atom_idx( actionplanner_t* ap, const char* atomname )
+{
+	return idx_for_atomname( ap, atomname );
+}
+
+
+int goap_action_idx( actionplanner_t* ap, const char* actionname )
+{
+	return idx_for_actionname( ap, actionname );
+}
+
+
+void goap_worldstate_set_idx( worldstate_t* ws, int atom, bool value )
+{
+	bfield_set( &ws->values, atom, value );
+	bfield_set( &ws->dontcare, atom, false );
+}
+
 
-extern bool goap_set_pre( actionplanner_t* ap, const char* actionname, const char* atomname, bool value )
+bool goap_set_pre( actionplanner_t* ap, const char* actionname, const char* atomname, bool value )
 {
 	const int actidx = idx_for_actionname( ap, actionname );
 	const int atmidx = idx_for_atomname( ap, atomname );
 	if ( actidx == -1 || atmidx == -1 ) return false;
-	goap_worldstate_set( ap, ap->act_pre+actidx, atomname, value );
-	return true;
+	return goap_set_pre_idx( ap, actidx, atmidx, value );
 }
 
 
@@ -106,8 +197,7 @@ bool goap_set_pst( actionplanner_t* ap, const char* actionname, const char* atom
 	const int actidx = idx_for_actionname( ap, actionname );
 	const int atmidx = idx_for_atomname( ap, atomname );
 	if ( actidx == -1 || atmidx == -1 ) return false;
-	goap_worldstate_set( ap, ap->act_pst+actidx, atomname, value );
-	return true;
+	return goap_set_pst_idx( ap, actidx, atmidx, value );
 }
 
 
@@ -115,17 +205,96 @@ bool goap_set_cost( actionplanner_t* ap, const char* actionname, int cost )
 {
 	const int actidx = idx_for_actionname( ap, actionname );
 	if ( actidx == -1 ) return false;
-	ap->act_costs[ actidx ] = cost;
+	return goap_set_cost_idx( ap, actidx, cost );
+}
+
+
+bool goap_set_pre_idx( actionplanner_t* ap, int action, int atom, bool value )
+{
+	if ( ap->frozen || action < 0 || action >= ap->numactions || atom < 0 || atom >= ap->numatoms ) return false;
+	goap_worldstate_set_idx( ap->act_pre+action, atom, value );
+	compile_action( ap, action );
+	ap->version++;
+	return true;
+}
+
+
+bool goap_set_pst_idx( actionplanner_t* ap, int action, int atom, bool value )
+{
+	if ( ap->frozen || action < 0 || action >= ap->numactions || atom < 0 || atom >= ap->numatoms ) return false;
+	goap_worldstate_set_idx( ap->act_pst+action, atom, value );
+	compile_action( ap, action );
+	ap->version++;
+	return true;
+}
+
+
+bool goap_set_cost_idx( actionplanner_t* ap, int action, int cost )
+{
+	if ( ap->frozen || action < 0 || action >= ap->numactions ) return false;
+	ap->act_costs[ action ] = cost;
+	ap->version++;
+	return true;
+}
+
+
+void goap_freeze( actionplanner_t* ap )
+{
+	ap->frozen = true;
+}
+
+
+void goap_overlay_init( goapoverlay_t* ov, actionplanner_t const* domain )
+{
+	ov->domain = domain;
+	ov->enabled = domain->numactions < 64 ? ( 1ULL << domain->numactions ) - 1 : ~0ULL;
+	memcpy( ov->act_costs, domain->act_costs, sizeof( ov->act_costs ) );
+}
+
+
+bool goap_overlay_enable_idx( goapoverlay_t* ov, int action, bool enabled )
+{
+	if ( action < 0 || action >= ov->domain->numactions ) return false;
+	const uint64_t bit = 1ULL << action;
+	ov->enabled = enabled ? ( ov->enabled | bit ) : ( ov->enabled & ~bit );
 	return true;
 }
 
 
+bool goap_overlay_set_cost_idx( goapoverlay_t* ov, int action, int cost )
+{
+	if ( action < 0 || action >= ov->domain->numactions ) return false;
+	ov->act_costs[ action ] = cost;
+	return true;
+}
+
+
+//!< Look up an action of a frozen planner, without adding it. Returns -1 if there is no such action.
+static int find_actionname( actionplanner_t const* ap, const char* actionname )
+{
+	// the slot is only read, so the const cast does not change the planner.
+	return *slot_for_name( (int16_t*) ap->act_hash, 2*MAXACTIONS, ap->act_names, actionname );
+}
+
+
+bool goap_overlay_enable( goapoverlay_t* ov, const char* actionname, bool enabled )
+{
+	return goap_overlay_enable_idx( ov, find_actionname( ov->domain, actionname ), enabled );
+}
+
+
+bool goap_overlay_set_cost( goapoverlay_t* ov, const char* actionname, int cost )
+{
+	return goap_overlay_set_cost_idx( ov, find_actionname( ov->domain, actionname ), cost );
+}
+
+
 void goap_worldstate_description( const actionplanner_t* ap, const worldstate_t* ws, char* buf, int sz )
 {
 	int added=0;
 	for ( int i=0; i<MAXATOMS; ++i )
 	{
-		if ( ( ws->dontcare & ( 1LL << i ) ) == 0LL )
+		if ( !bfield_get( ws->dontcare, i ) )
 		{
 			const char* val = ap->atm_names[ i ];
 			char upval[ 128 ];
@@ -133,7 +302,7 @@ void goap_worldstate_description( const actionplanner_t* ap, const worldstate_t*
 			for ( j=0; j<strlen( val ); ++j )
 				upval[ j ] = ( val[ j ] - 32 );
 			upval[ j++ ] = 0;
-			const bool set = ( ( ws->values & ( 1LL << i ) ) != 0LL );
+			const bool set = bfield_get( ws->values, i );
 			added = snprintf( buf, sz, "%s,", set?upval:val );
 			buf += added; sz -= added;
 		}
@@ -152,16 +321,16 @@ void goap_description( actionplanner_t* ap, char* buf, int sz )
 		worldstate_t pre = ap->act_pre[ a ];
 		worldstate_t pst = ap->act_pst[ a ];
 		for ( int i=0; i<MAXATOMS; ++i )
-			if ( ( pre.dontcare & ( 1LL << i ) ) == 0LL )
+			if ( !bfield_get( pre.dontcare, i ) )
 			{
-				bool v = ( pre.values & ( 1LL << i ) ) != 0LL;
+				bool v = bfield_get( pre.values, i );
 				added = snprintf( buf, sz, "  %s==%d\n", ap->atm_names[ i ], v );
 				sz -= added; buf+= added;
 			}
 		for ( int i=0; i<MAXATOMS; ++i )
-			if ( ( pst.dontcare & ( 1LL << i ) ) == 0LL )
+			if ( !bfield_get( pst.dontcare, i ) )
 			{
-				bool v = ( pst.values & ( 1LL << i ) ) != 0LL;
+				bool v = bfield_get( pst.values, i );
 				added = snprintf( buf, sz, "  %s:=%d\n", ap->atm_names[ i ], v );
 				sz -= added; buf+= added;
 			}
@@ -169,35 +338,200 @@ void goap_description( actionplanner_t* ap, char* buf, int sz )
 }
 
 
-static worldstate_t goap_do_action( actionplanner_t const* ap, int actionnr, worldstate_t fr )
+uint64_t goap_applicable_actions( actiontable_t const* table, bfield_t values )
 {
-	const worldstate_t pst = ap->act_pst[ actionnr ];
-	const bfield_t unaffected = pst.dontcare;
-	const bfield_t affected   = ( unaffected ^ -1LL );
+	// Unused table entries have no preconditions, so they always pass: mask them out at the end.
+	const int n = table->numactions;
+	uint64_t met = 0;
+#if defined( __AVX2__ )
+	// Test 4 actions per instruction.
+	for ( int a=0; a<n; a+=4 )
+	{
+		__m256i diff = _mm256_setzero_si256();
+		for ( int w=0; w<GOAP_WORDS; ++w )
+		{
+			const __m256i v = _mm256_set1_epi64x( (long long) bfield_word( values, w ) );
+			const __m256i care = _mm256_loadu_si256( (const __m256i*)( table->pre_care[ w ] + a ) );
+			const __m256i want = _mm256_loadu_si256( (const __m256i*)( table->pre_values[ w ] + a ) );
+			diff = _mm256_or_si256( diff, _mm256_xor_si256( _mm256_and_si256( v, care ), want ) );
+		}
+		const __m256i eq = _mm256_cmpeq_epi64( diff, _mm256_setzero_si256() );
+		met |= (uint64_t) _mm256_movemask_pd( _mm256_castsi256_pd( eq ) ) << a;
+	}
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+	// Test 2 actions per instruction. SSE2 has no 64 bit compare, so combine the compares of both 32 bit halves.
+	for ( int a=0; a<n; a+=2 )
+	{
+		__m128i diff = _mm_setzero_si128();
+		for ( int w=0; w<GOAP_WORDS; ++w )
+		{
+			const __m128i v = _mm_set1_epi64x( (long long) bfield_word( values, w ) );
+			const __m128i care = _mm_loadu_si128( (const __m128i*)( table->pre_care[ w ] + a ) );
+			const __m128i want = _mm_loadu_si128( (const __m128i*)( table->pre_values[ w ] + a ) );
+			diff = _mm_or_si128( diff, _mm_xor_si128( _mm_and_si128( v, care ), want ) );
+		}
+		const __m128i eq32 = _mm_cmpeq_epi32( diff, _mm_setzero_si128() );
+		const __m128i eq = _mm_and_si128( eq32, _mm_shuffle_epi32( eq32, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		met |= (uint64_t) _mm_movemask_pd( _mm_castsi128_pd( eq ) ) << a;
+	}
+#else
+	for ( int a=0; a<n; ++a )
+	{
+		uint64_t diff = 0;
+		for ( int w=0; w<GOAP_WORDS; ++w )
+			diff |= ( bfield_word( values, w ) & table->pre_care[ w ][ a ] ) ^ table->pre_values[ w ][ a ];
+		met |= (uint64_t)( diff == 0 ) << a;
+	}
+#endif
+	return n < 64 ? met & ( ( 1ULL << n ) - 1 ) : met;
+}
+
 
-	fr.values = ( fr.values & unaffected ) | ( pst.values & affected );
-	fr.dontcare &= pst.dontcare;
+worldstate_t goap_apply_action( actiontable_t const* table, int action, worldstate_t fr )
+{
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		const uint64_t affected = table->pst_care[ w ][ action ];
+		bfield_setword( &fr.values, w, ( bfield_word( fr.values, w ) & ~affected ) | table->pst_values[ w ][ action ] );
+		bfield_setword( &fr.dontcare, w, bfield_word( fr.dontcare, w ) & ~affected );
+	}
 	return fr;
 }
 
 
-int goap_get_possible_state_transitions( actionplanner_t const* ap, worldstate_t fr, worldstate_t* to, const char** actionnames, int* actioncosts, int cnt )
+bool goap_regress_action( actiontable_t const* table, int action, worldstate_t goal, worldstate_t* pre )
 {
-	int writer=0;
-	for ( int i=0; i<ap->numactions && writer<cnt; ++i )
+	uint64_t achieved = 0;
+	for ( int w=0; w<GOAP_WORDS; ++w )
 	{
-		// see if precondition is met
-		const worldstate_t pre = ap->act_pre[ i ];
-		const bfield_t care = ( pre.dontcare ^ -1LL );
-		const bool met = ( ( pre.values & care ) == ( fr.values & care ) );
-		if ( met )
+		const uint64_t care = ~bfield_word( goal.dontcare, w );
+		const uint64_t values = bfield_word( goal.values, w );
+		const uint64_t affected = table->pst_care[ w ][ action ];
+		const uint64_t required = table->pre_care[ w ][ action ];
+		if ( ( values ^ table->pst_values[ w ][ action ] ) & care & affected ) return false;	// the action undoes part of the goal.
+		const uint64_t kept = care & ~affected;
+		if ( ( values ^ table->pre_values[ w ][ action ] ) & kept & required ) return false;	// the action needs what the goal rules out.
+		achieved |= care & affected;
+		bfield_setword( &pre->values, w, ( values & kept ) | table->pre_values[ w ][ action ] );
+		bfield_setword( &pre->dontcare, w, ~( kept | required ) );
+	}
+	return achieved != 0;
+}
+
+
+//!< Internal function to find an atom on which the values differ from the wanted ones, among those that are cared for. Returns -1 if there is none.
+static int first_unmet( bfield_t values, bfield_t wanted, bfield_t care )
+{
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		const uint64_t unmet = ( bfield_word( values, w ) ^ bfield_word( wanted, w ) ) & bfield_word( care, w );
+		if ( unmet ) return 64*w + bfield_ctz64( unmet );
+	}
+	return -1;
+}
+
+
+uint64_t goap_stubborn_actions( actiontable_t const* table, uint64_t enabled, bfield_t values, worldstate_t goal )
+{
+	const uint64_t applicable = goap_applicable_actions( table, values ) & enabled;
+	bfield_t goalcare;
+	for ( int w=0; w<GOAP_WORDS; ++w ) bfield_setword( &goalcare, w, ~bfield_word( goal.dontcare, w ) );
+	const int atom = first_unmet( values, goal.values, goalcare );
+	if ( atom < 0 ) return applicable;
+
+	// every plan must make this goal atom right, so one of its achievers comes first among the actions of the set.
+	uint64_t stubborn = table->achievers[ bfield_get( goal.values, atom ) ][ atom ] & enabled;
+	uint64_t todo = stubborn;
+	while ( todo )
+	{
+		const int a = bfield_ctz64( todo );
+		todo &= todo-1;
+		uint64_t add;
+		if ( ( applicable >> a ) & 1 )
 		{
-			actionnames[ writer ] = ap->act_names[ i ];
-			actioncosts[ writer ] = ap->act_costs[ i ];
-			to[ writer ] = goap_do_action( ap, i, fr );
-			++writer;
+			// an applicable action must not be swapped past an action that it interferes with.
+			add = table->interferes[ a ] & enabled;
+		}
+		else
+		{
+			// an inapplicable action needs one of its unmet preconditions achieved first.
+			bfield_t prevalues, precare;
+			for ( int w=0; w<GOAP_WORDS; ++w )
+			{
+				bfield_setword( &prevalues, w, table->pre_values[ w ][ a ] );
+				bfield_setword( &precare, w, table->pre_care[ w ][ a ] );
+			}
+			const int pre = first_unmet( values, prevalues, precare );
+			add = table->achievers[ bfield_get( prevalues, pre ) ][ pre ] & enabled;
 		}
+		todo |= add & ~stubborn;
+		stubborn |= add;
+	}
+	return stubborn & applicable;
+}
+
+
+uint64_t goap_relevant_actions( actiontable_t const* table, worldstate_t goal )
+{
+	// the literals that are needed, as one mask of atoms needed true and one of atoms needed false. We start with those of the goal.
+	uint64_t need1[ GOAP_WORDS ], need0[ GOAP_WORDS ];
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		const uint64_t care = ~bfield_word( goal.dontcare, w );
+		need1[ w ] = care & bfield_word( goal.values, w );
+		need0[ w ] = care & ~bfield_word( goal.values, w );
+	}
+	// an action that makes a needed literal true is relevant, and then its preconditions are needed as well.
+	const uint64_t all = table->numactions < 64 ? ( 1ULL << table->numactions ) - 1 : ~0ULL;
+	uint64_t relevant = 0;
+	bool changed = true;
+	while ( changed )
+	{
+		changed = false;
+		for ( uint64_t todo = all & ~relevant; todo; todo &= todo-1 )
+		{
+			const int a = bfield_ctz64( todo );
+			uint64_t achieved = 0;
+			for ( int w=0; w<GOAP_WORDS; ++w )
+				achieved |= table->pst_care[ w ][ a ] & ( ( table->pst_values[ w ][ a ] & need1[ w ] ) | ( ~table->pst_values[ w ][ a ] & need0[ w ] ) );
+			if ( !achieved ) continue;
+			relevant |= 1ULL << a;
+			for ( int w=0; w<GOAP_WORDS; ++w )
+			{
+				need1[ w ] |= table->pre_care[ w ][ a ] & table->pre_values[ w ][ a ];
+				need0[ w ] |= table->pre_care[ w ][ a ] & ~table->pre_values[ w ][ a ];
+			}
+			changed = true;
+		}
+	}
+	return relevant;
+}
+
+
+int goap_get_successors( actiontable_t const* table, uint64_t enabled, worldstate_t fr, worldstate_t* to, int* actions, int cnt )
+{
+	uint64_t met = goap_applicable_actions( table, fr.values ) & enabled;
+	int writer=0;
+	while ( met && writer<cnt )
+	{
+		const int i = bfield_ctz64( met );
+		met &= met - 1;
+		actions[ writer ] = i;
+		to[ writer ] = goap_apply_action( table, i, fr );
+		++writer;
 	}
 	return writer;
 }
 
+
+int goap_get_possible_state_transitions( actionplanner_t const* ap, worldstate_t fr, worldstate_t* to, const char** actionnames, int* actioncosts, int cnt )
+{
+	int actions[ MAXACTIONS ];
+	const int writer = goap_get_successors( &ap->act_table, ~0ULL, fr, to, actions, cnt < MAXACTIONS ? cnt : MAXACTIONS );
+	for ( int i=0; i<writer; ++i )
+	{
+		actionnames[ i ] = ap->act_names[ actions[ i ] ];
+		actioncosts[ i ] = ap->act_costs[ actions[ i ] ];
+	}
+	return writer;
+}
@@ -11,21 +11,16 @@ Unless required by applicable law or agreed to in writing, software distributed
 #ifndef GOAP_H
 #define GOAP_H
 
+#include "bfield.h"
+
 #ifdef __cplusplus
 extern "C"
 {
-#include <cstdbool>
-#include <cstdint>
-#else
-#include <stdbool.h>
-#include <stdint.h>
 #endif
 
-#define MAXATOMS 64
+#define MAXATOMS ( 64 * GOAP_WORDS )
 #define MAXACTIONS 64
 
-typedef int64_t bfield_t;
-
 //!< Describes the world state by listing values (t/f) for all known atoms.
 typedef struct 
 {
@@ -34,6 +29,20 @@ typedef struct
 } worldstate_t;
 
 
+//!< The action repertoire compiled for fast successor generation. Conditions are stored per bit field word with one entry per action,
+//!< so that the preconditions of several actions can be tested with a single SIMD instruction.
+typedef struct
+{
+	uint64_t pre_values[ GOAP_WORDS ][ MAXACTIONS ];	//!< Precondition values, with atoms that do not matter cleared.
+	uint64_t pre_care[ GOAP_WORDS ][ MAXACTIONS ];		//!< Atoms tested by the preconditions.
+	uint64_t pst_values[ GOAP_WORDS ][ MAXACTIONS ];	//!< Postcondition values, with atoms that are not affected cleared.
+	uint64_t pst_care[ GOAP_WORDS ][ MAXACTIONS ];		//!< Atoms affected by the postconditions.
+	uint64_t achievers[ 2 ][ MAXATOMS ];			//!< Bit i of entry [v][atom] is set if action i makes the atom take value v.
+	uint64_t interferes[ MAXACTIONS ];			//!< Bit i of entry j is set if actions i and j cannot be swapped: one of them disables the other, or their effects conflict.
+	int numactions;						//!< The number of actions in the table.
+} actiontable_t;
+
+
 //!< Action planner that keeps track of world state atoms and its action repertoire.
 typedef struct
 {
@@ -46,9 +55,26 @@ typedef struct
 	int act_costs[ MAXACTIONS ];		//!< Cost for all actions.
 	int numactions;				//!< The number of actions in out repertoire.
 
+	actiontable_t act_table;		//!< Pre and postconditions in compiled form. Kept up to date by goap_set_pre() and goap_set_pst().
+
+	unsigned int version;			//!< Bumped whenever the actions change, so that plans made for an older version can be told apart.
+	bool frozen;				//!< Set by goap_freeze(): atoms and actions can no longer change, so the planner can be shared by many agents and threads.
+
+	int16_t atm_hash[ 2*MAXATOMS ];		//!< Open addressing index from atom name to atom index, -1 for empty slots.
+	int16_t act_hash[ 2*MAXACTIONS ];	//!< Open addressing index from action name to action index, -1 for empty slots.
 } actionplanner_t;
 
 
+//!< Per-agent changes to a frozen planner: which actions the agent may use, and what they cost for it.
+//!< Much smaller than a planner, so that thousands of agents can share one domain. The domain is not copied.
+typedef struct
+{
+	actionplanner_t const* domain;	//!< The frozen planner that this overlay applies to. Must outlive the overlay.
+	uint64_t enabled;		//!< Bit i is set if the agent may use action i.
+	int act_costs[ MAXACTIONS ];	//!< Cost for all actions, for this agent.
+} goapoverlay_t;
+
+
 //!< Initialize an action planner. It will clear all information on actions and state.
 extern void goap_actionplanner_clear( actionplanner_t* ap );
 
@@ -58,6 +84,25 @@ extern void goap_worldstate_clear( worldstate_t* ws );
 //!< Set an atom of worldstate to specified value.
 extern bool goap_worldstate_set( actionplanner_t* ap, worldstate_t* ws, const char* atomname, bool value );
 
+//!< Get the index of the named atom, adding the atom if it is new. Returns -1 if there is no room for more atoms, or if the planner is frozen and does not know the atom.
+//!< Resolve names once, then use the index with the *_idx() functions, which do no string work at all.
+extern int  goap_atom_idx( actionplanner_t* ap, const char* atomname );
+
+//!< Get the index of the named action, adding the action if it is new. Returns -1 if there is no room for more actions, or if the planner is frozen and does not know the action.
+extern int  goap_action_idx( actionplanner_t* ap, const char* actionname );
+
+//!< Set an atom of worldstate, given by index, to specified value.
+extern void goap_worldstate_set_idx( worldstate_t* ws, int atom, bool value );
+
+//!< Add a precondition for an action, with action and atom given by index.
+extern bool goap_set_pre_idx( actionplanner_t* ap, int action, int atom, bool value );
+
+//!< Add a postcondition for an action, with action and atom given by index.
+extern bool goap_set_pst_idx( actionplanner_t* ap, int action, int atom, bool value );
+
+//!< Set the cost for an action given by index.
+extern bool goap_set_cost_idx( actionplanner_t* ap, int action, int cost );
+
 //!< Add a precondition for named action.
 extern bool goap_set_pre( actionplanner_t* ap, const char* actionname, const char* atomname, bool value );
 
@@ -67,6 +112,25 @@ extern bool goap_set_pst( actionplanner_t* ap, const char* actionname, const cha
 //!< Set the cost for named action.
 extern bool goap_set_cost( actionplanner_t* ap, const char* actionname, int cost );
 
+//!< Freeze the planner into a read-only domain. Setting conditions or costs fails afterwards, and names that are not known yet are no longer added.
+//!< Looking up known names does not change the planner, so a frozen planner can be used by many threads at once.
+extern void goap_freeze( actionplanner_t* ap );
+
+//!< Initialize an overlay on a frozen planner, with all actions enabled at their base cost.
+extern void goap_overlay_init( goapoverlay_t* ov, actionplanner_t const* domain );
+
+//!< Enable or disable an action given by index, for the agent of this overlay.
+extern bool goap_overlay_enable_idx( goapoverlay_t* ov, int action, bool enabled );
+
+//!< Set the cost of an action given by index, for the agent of this overlay.
+extern bool goap_overlay_set_cost_idx( goapoverlay_t* ov, int action, int cost );
+
+//!< Enable or disable the named action, for the agent of this overlay.
+extern bool goap_overlay_enable( goapoverlay_t* ov, const char* actionname, bool enabled );
+
+//!< Set the cost of the named action, for the agent of this overlay.
+extern bool goap_overlay_set_cost( goapoverlay_t* ov, const char* actionname, int cost );
+
 //!< Describe the action planner by listing all actions with pre and post conditions. For debugging purpose.
 extern void goap_description( actionplanner_t* ap, char* buf, int sz );
 
@@ -76,6 +140,27 @@ extern void goap_worldstate_description( const actionplanner_t* ap, const worlds
 //!< Given the specified 'from' state, list all possible 'to' states along with the action required, and the action cost. For internal use.
 extern int  goap_get_possible_state_transitions( actionplanner_t const* ap, worldstate_t fr, worldstate_t* to, const char** actionnames, int* actioncosts, int cnt );
 
+//!< Given the specified state, return a bitmask with bit i set if the preconditions of action i are met. For internal use.
+extern uint64_t goap_applicable_actions( actiontable_t const* table, bfield_t values );
+
+//!< Apply the effects of an action to the specified state. For internal use.
+extern worldstate_t goap_apply_action( actiontable_t const* table, int action, worldstate_t fr );
+
+//!< Find the partial state from which the action reaches the specified partial goal. Returns false if the action achieves none of the goal, or contradicts it. For internal use.
+extern bool goap_regress_action( actiontable_t const* table, int action, worldstate_t goal, worldstate_t* pre );
+
+//!< Find the actions that can contribute to the goal, as a bitmask with bit i set for action i. An action contributes if it makes a literal true that the goal,
+//!< or the precondition of a contributing action, asks for. Other actions can be left out of a search without making its plans longer or costlier. For internal use.
+extern uint64_t goap_relevant_actions( actiontable_t const* table, worldstate_t goal );
+
+//!< Find a strong stubborn set for the specified state: applicable actions, as a bitmask, such that expanding only these still finds an optimal plan.
+//!< Actions that do not interfere with the set are left out, as they can be done later instead, so that orderings of independent actions are not all explored.
+//!< Only actions in the enabled mask are considered. The state must not satisfy the goal. For internal use.
+extern uint64_t goap_stubborn_actions( actiontable_t const* table, uint64_t enabled, bfield_t values, worldstate_t goal );
+
+//!< Given the specified 'from' state, list all possible 'to' states along with the index of the action required. Only actions in the enabled mask are considered. For internal use.
+extern int  goap_get_successors( actiontable_t const* table, uint64_t enabled, worldstate_t fr, worldstate_t* to, int* actions, int cnt );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,467 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Domains declared at compile time, for C++17. A domain is a struct with an enum of atoms, their names, and a constexpr array of actions:
+//
+//	struct Soldier
+//	{
+//		enum Atom { armedwithgun, enemyvisible, ..., numatoms };
+//		static constexpr int words = gpgoap::words( numatoms );
+//		static constexpr const char* atom_names[ numatoms ] = { "armedwithgun", "enemyvisible", ... };
+//		static constexpr gpgoap::Action<words> actions[] =
+//		{
+//			gpgoap::action<words>( "scout", 1, { gpgoap::is( armedwithgun ) }, { gpgoap::is( enemyvisible ) } ),
+//			...
+//		};
+//	};
+//
+// gpgoap::Search<Soldier> then plans with conditions that are constants in the code, and the same domain can be loaded into an
+// actionplanner_t with gpgoap::to_planner() for everything that the C API offers.
+
+#ifndef GOAP_HPP
+#define GOAP_HPP
+
+#include "goap.h"
+#include "astar.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+
+namespace gpgoap
+{
+
+//! The nr of 64 bit words that hold the specified nr of atoms.
+constexpr int words( int numatoms )
+{
+	return ( numatoms + 63 ) / 64;
+}
+
+
+//!< An atom together with the value that a condition asks for, or that an effect gives it.
+struct Literal
+{
+	int atom;	//!< Index of the atom, a value of the domain's atom enum.
+	bool value;	//!< The value.
+};
+
+//! The literal for an atom that is true.
+constexpr Literal is( int atom ) { return Literal{ atom, true }; }
+
+//! The literal for an atom that is false.
+constexpr Literal isnot( int atom ) { return Literal{ atom, false }; }
+
+
+//!< The state of a domain: the values of all of its atoms, in as few words as the domain needs.
+template <int Words>
+struct State
+{
+	uint64_t values[ Words ];	//!< Values for atoms.
+};
+
+
+//!< A set of literals, such as a goal or the conditions of an action.
+template <int Words>
+struct Mask
+{
+	uint64_t values[ Words ];	//!< Values of the atoms in the set, cleared for atoms that are not.
+	uint64_t care[ Words ];		//!< Atoms in the set.
+};
+
+
+//!< An action of a domain, with its conditions compiled into masks.
+template <int Words>
+struct Action
+{
+	const char* name;	//!< The name of the action, as used by to_planner().
+	Mask<Words> pre;	//!< Preconditions.
+	Mask<Words> pst;	//!< Postconditions (action effects).
+	int cost;		//!< Cost of the action.
+};
+
+
+//! Compile a set of literals into a mask.
+template <int Words>
+constexpr Mask<Words> mask( std::initializer_list<Literal> literals )
+{
+	Mask<Words> m{};
+	for ( const Literal& l : literals )
+	{
+		const uint64_t bit = 1ULL << ( l.atom % 64 );
+		m.care[ l.atom / 64 ] |= bit;
+		if ( l.value ) m.values[ l.atom / 64 ] |= bit;
+		else m.values[ l.atom / 64 ] &= ~bit;
+	}
+	return m;
+}
+
+
+//! Compile an action from its name, cost, preconditions and postconditions.
+template <int Words>
+constexpr Action<Words> action( const char* name, int cost, std::initializer_list<Literal> pre, std::initializer_list<Literal> pst )
+{
+	return Action<Words>{ name, mask<Words>( pre ), mask<Words>( pst ), cost };
+}
+
+
+//! Build the state of a domain from literals. Atoms that are not named are false.
+template <int Words>
+constexpr State<Words> state( std::initializer_list<Literal> literals )
+{
+	const Mask<Words> m = mask<Words>( literals );
+	State<Words> s{};
+	for ( int w=0; w<Words; ++w ) s.values[ w ] = m.values[ w ];
+	return s;
+}
+
+
+//! Count the bits that are set, at compile time.
+constexpr int popcount( uint64_t x )
+{
+	int n = 0;
+	for ( ; x; x &= x - 1 ) n++;
+	return n;
+}
+
+
+//!< What a search needs to know about a domain, derived from its declaration at compile time.
+template <typename D>
+struct Traits
+{
+	static constexpr int words = gpgoap::words( D::numatoms );		//!< The nr of words in a state.
+	static constexpr int numactions = (int) std::size( D::actions );	//!< The nr of actions.
+
+	//! The lowest action cost. Together with maxeffects(), this turns the nr of unmet goal atoms into an estimate that never overestimates.
+	static constexpr int mincost()
+	{
+		int c = numactions ? D::actions[ 0 ].cost : 0;
+		for ( int a=1; a<numactions; ++a ) if ( D::actions[ a ].cost < c ) c = D::actions[ a ].cost;
+		return c;
+	}
+
+	//! The most atoms that a single action changes.
+	static constexpr int maxeffects()
+	{
+		int e = 1;
+		for ( int a=0; a<numactions; ++a )
+		{
+			int n = 0;
+			for ( int w=0; w<words; ++w ) n += popcount( D::actions[ a ].pst.care[ w ] );
+			if ( n > e ) e = n;
+		}
+		return e;
+	}
+
+	static_assert( numactions <= MAXACTIONS, "A domain can have at most MAXACTIONS actions." );
+	static_assert( numactions < 256, "Action indices must fit in a byte." );
+};
+
+
+//!< Internal function to add the successor that an action, given by its index, leads to, if its preconditions are met.
+//!< All masks are constants, so the tests compile to a few instructions, and words that an action does not look at drop out.
+template <typename D, int A>
+inline void try_action( const State<Traits<D>::words>& fr, State<Traits<D>::words>* to, int* actions, int& n )
+{
+	constexpr int W = Traits<D>::words;
+	constexpr Action<W> act = D::actions[ A ];
+	for ( int w=0; w<W; ++w )
+		if ( ( fr.values[ w ] & act.pre.care[ w ] ) != act.pre.values[ w ] ) return;
+	for ( int w=0; w<W; ++w )
+		to[ n ].values[ w ] = ( fr.values[ w ] & ~act.pst.care[ w ] ) | act.pst.values[ w ];
+	actions[ n++ ] = A;
+}
+
+
+template <typename D, std::size_t... A>
+inline int successors( const State<Traits<D>::words>& fr, State<Traits<D>::words>* to, int* actions, std::index_sequence<A...> )
+{
+	int n = 0;
+	( try_action<D, (int)A>( fr, to, actions, n ), ... );
+	return n;
+}
+
+
+//! List all states that the domain's actions lead to from the specified state, along with the index of the action. Unrolled over all actions.
+//! The arrays must have room for all actions. Returns the nr of successors.
+template <typename D>
+inline int successors( const State<Traits<D>::words>& fr, State<Traits<D>::words>* to, int* actions )
+{
+	return successors<D>( fr, to, actions, std::make_index_sequence<Traits<D>::numactions>() );
+}
+
+
+//! Does the state meet the conditions of the mask?
+template <int Words>
+inline bool satisfies( const State<Words>& s, const Mask<Words>& m )
+{
+	for ( int w=0; w<Words; ++w )
+		if ( ( s.values[ w ] & m.care[ w ] ) != m.values[ w ] ) return false;
+	return true;
+}
+
+
+//!< A search specialized to a domain, with room for MaxNodes nodes. It does not allocate: all storage is part of the object, so keep it
+//!< around (one per thread) rather than on the stack. Plans are optimal: nodes are estimated by the nr of unmet goal atoms,
+//!< divided by the most atoms that an action changes, times the lowest action cost.
+template <typename D, int MaxNodes = 4096>
+class Search
+{
+public:
+	static constexpr int words = Traits<D>::words;
+	using state_t = State<words>;
+	using goal_t = Mask<words>;
+
+	Search()
+	{
+		for ( int i=0; i<hashsize; ++i ) hash[ i ] = -1;
+	}
+
+	//! Make a plan of actions that will reach the goal. Returns the plan cost, ASTAR_NOPATH, or ASTAR_OVERBUDGET if the search needs more than MaxNodes nodes.
+	//! Actions are returned as indices into D::actions, and plansize works as for astar_plan().
+	int plan( const state_t& start, const goal_t& goal, int* plan, state_t* states, int* plansize )
+	{
+		clear();
+		add( find( start ), start, -1, -1, 0, estimate( start, goal ) );
+		while ( numopened )
+		{
+			const int cur = pop();
+			if ( satisfies( nodes[ cur ], goal ) )
+			{
+				reconstruct( cur, plan, states, plansize );
+				return g[ cur ];
+			}
+			state_t to[ Traits<D>::numactions ];
+			int actions[ Traits<D>::numactions ];
+			const int n = successors<D>( nodes[ cur ], to, actions );
+			for ( int i=0; i<n; ++i )
+			{
+				const int cost = g[ cur ] + D::actions[ actions[ i ] ].cost;
+				int* slot = find( to[ i ] );
+				if ( *slot >= 0 )
+				{
+					const int idx = *slot;
+					if ( cost >= g[ idx ] ) continue;
+					g[ idx ] = cost;
+					parent[ idx ] = cur;
+					action[ idx ] = (uint8_t)actions[ i ];
+					if ( heapidx[ idx ] >= 0 ) up( heapidx[ idx ] );
+					else push( idx );
+				}
+				else
+				{
+					if ( numnodes == MaxNodes ) return ASTAR_OVERBUDGET;
+					add( slot, to[ i ], cur, actions[ i ], cost, estimate( to[ i ], goal ) );
+				}
+			}
+		}
+		return ASTAR_NOPATH;
+	}
+
+	//! The nr of nodes that the last search stored.
+	int size() const { return numnodes; }
+
+private:
+	static constexpr int hashsize = [] { int n = 1; while ( n < 2 * MaxNodes ) n *= 2; return n; }();	//!< Slots in the index, a power of two.
+	static constexpr int mincost = Traits<D>::mincost();
+	static constexpr int maxeffects = Traits<D>::maxeffects();
+
+	state_t nodes[ MaxNodes ];	//!< The state of each node.
+	int32_t parent[ MaxNodes ];	//!< Index of the parent node, -1 for the root.
+	uint8_t action[ MaxNodes ];	//!< Index of the action that leads here from the parent.
+	int32_t g[ MaxNodes ];		//!< The cost so far.
+	int32_t h[ MaxNodes ];		//!< The estimate of the remaining cost.
+	int32_t heapidx[ MaxNodes ];	//!< Position in the opened heap, -1 if closed.
+	int32_t opened[ MaxNodes ];	//!< Binary heap of opened nodes, lowest g+h on top, ties to the lowest h.
+	int32_t hash[ hashsize ];	//!< Open addressing index from state to node, -1 for empty slots.
+	int numnodes = 0;
+	int numopened = 0;
+
+	static int estimate( const state_t& s, const goal_t& goal )
+	{
+		int unmet = 0;
+		for ( int w=0; w<words; ++w )
+			unmet += bfield_popcount64( ( s.values[ w ] ^ goal.values[ w ] ) & goal.care[ w ] );
+		return ( unmet + maxeffects - 1 ) / maxeffects * mincost;
+	}
+
+	int* find( const state_t& s )
+	{
+		uint64_t k = 0;
+		for ( int w=0; w<words; ++w ) k = ( k ^ s.values[ w ] ) * 0x9e3779b97f4a7c15ULL;
+		uint64_t slot = ( k >> 32 ) & ( hashsize - 1 );
+		while ( true )
+		{
+			int* entry = hash + slot;
+			if ( *entry < 0 || same( nodes[ *entry ], s ) ) return entry;
+			slot = ( slot + 1 ) & ( hashsize - 1 );
+		}
+	}
+
+	static bool same( const state_t& a, const state_t& b )
+	{
+		for ( int w=0; w<words; ++w ) if ( a.values[ w ] != b.values[ w ] ) return false;
+		return true;
+	}
+
+	void clear()
+	{
+		// remove from the index in reverse order of addition: probing for a node then only passes over older nodes, which are still indexed.
+		for ( int i=numnodes-1; i>=0; --i ) *find( nodes[ i ] ) = -1;
+		numnodes = 0;
+		numopened = 0;
+	}
+
+	void add( int* slot, const state_t& s, int par, int act, int cost, int est )
+	{
+		const int idx = numnodes++;
+		*slot = idx;
+		nodes[ idx ] = s;
+		parent[ idx ] = par;
+		action[ idx ] = (uint8_t)act;
+		g[ idx ] = cost;
+		h[ idx ] = est;
+		push( idx );
+	}
+
+	bool lower( int a, int b ) const
+	{
+		const int fa = g[ a ] + h[ a ];
+		const int fb = g[ b ] + h[ b ];
+		return fa < fb || ( fa == fb && h[ a ] < h[ b ] );
+	}
+
+	void place( int pos, int idx ) { opened[ pos ] = idx; heapidx[ idx ] = pos; }
+
+	void up( int pos )
+	{
+		const int idx = opened[ pos ];
+		while ( pos > 0 && lower( idx, opened[ ( pos - 1 ) / 2 ] ) )
+		{
+			place( pos, opened[ ( pos - 1 ) / 2 ] );
+			pos = ( pos - 1 ) / 2;
+		}
+		place( pos, idx );
+	}
+
+	void push( int idx ) { place( numopened, idx ); up( numopened++ ); }
+
+	int pop()
+	{
+		const int top = opened[ 0 ];
+		heapidx[ top ] = -1;
+		const int idx = opened[ --numopened ];
+		int pos = 0;
+		while ( numopened )
+		{
+			int child = 2 * pos + 1;
+			if ( child >= numopened ) break;
+			if ( child + 1 < numopened && lower( opened[ child + 1 ], opened[ child ] ) ) child++;
+			if ( !lower( opened[ child ], idx ) ) break;
+			place( pos, opened[ child ] );
+			pos = child;
+		}
+		if ( numopened ) place( pos, idx );
+		return top;
+	}
+
+	void reconstruct( int goalidx, int* plan, state_t* states, int* plansize ) const
+	{
+		int numsteps = 0;
+		for ( int i=goalidx; parent[ i ] >= 0; i=parent[ i ] ) numsteps++;
+		const int skip = numsteps > *plansize ? numsteps - *plansize : 0;	// if the plan does not fit, return its tail.
+		int step = numsteps - 1;
+		for ( int i=goalidx; parent[ i ] >= 0; i=parent[ i ], --step )
+			if ( step >= skip )
+			{
+				plan[ step - skip ] = action[ i ];
+				states[ step - skip ] = nodes[ i ];
+			}
+		if ( skip )
+			LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+		*plansize = numsteps;
+	}
+};
+
+
+//! Load a domain into a runtime planner, so that it can also be planned with astar_plan() and the rest of the C API.
+//! The atoms get the indices of the atom enum, and the actions those of D::actions. Returns false if the planner does not have room.
+template <typename D>
+bool to_planner( actionplanner_t* ap )
+{
+	static_assert( D::numatoms <= MAXATOMS, "The domain has more atoms than a planner built with this GOAP_WORDS can hold." );
+	goap_actionplanner_clear( ap );
+	for ( int i=0; i<D::numatoms; ++i )
+		if ( goap_atom_idx( ap, D::atom_names[ i ] ) != i ) return false;
+	for ( int a=0; a<Traits<D>::numactions; ++a )
+	{
+		const auto& act = D::actions[ a ];
+		if ( goap_action_idx( ap, act.name ) != a ) return false;
+		for ( int i=0; i<D::numatoms; ++i )
+		{
+			const uint64_t bit = 1ULL << ( i % 64 );
+			if ( act.pre.care[ i / 64 ] & bit ) goap_set_pre_idx( ap, a, i, ( act.pre.values[ i / 64 ] & bit ) != 0 );
+			if ( act.pst.care[ i / 64 ] & bit ) goap_set_pst_idx( ap, a, i, ( act.pst.values[ i / 64 ] & bit ) != 0 );
+		}
+		goap_set_cost_idx( ap, a, act.cost );
+	}
+	return true;
+}
+
+
+//! Convert a state of a compile-time domain into a world state of the C API, in which the NumAtoms atoms of the domain are set and matter.
+//! Call it as to_worldstate<D::numatoms>( s ).
+template <int NumAtoms, int Words>
+worldstate_t to_worldstate( const State<Words>& s )
+{
+	static_assert( Words <= GOAP_WORDS, "The domain has more atoms than a world state built with this GOAP_WORDS can hold." );
+	static_assert( NumAtoms >= 0 && NumAtoms <= 64 * Words, "The domain has more atoms than its states have words for." );
+	worldstate_t ws;
+	goap_worldstate_clear( &ws );
+	for ( int w=0; w<Words; ++w )
+	{
+		const int n = NumAtoms - 64 * w;	// the nr of atoms of the domain in this word.
+		const uint64_t care = n >= 64 ? ~0ULL : n > 0 ? ( 1ULL << n ) - 1 : 0;
+		bfield_setword( &ws.values, w, s.values[ w ] & care );
+		bfield_setword( &ws.dontcare, w, ~care );
+	}
+	return ws;
+}
+
+
+//! Convert a goal of a compile-time domain into a world state of the C API, in which the atoms that are not in the goal do not matter.
+template <int Words>
+worldstate_t to_worldstate( const Mask<Words>& m )
+{
+	static_assert( Words <= GOAP_WORDS, "The domain has more atoms than a world state built with this GOAP_WORDS can hold." );
+	worldstate_t ws;
+	goap_worldstate_clear( &ws );
+	for ( int w=0; w<Words; ++w )
+	{
+		bfield_setword( &ws.values, w, m.values[ w ] );
+		bfield_setword( &ws.dontcare, w, ~m.care[ w ] );
+	}
+	return ws;
+}
+
+
+//! Convert a world state of the C API into a state of a compile-time domain, keeping the values of the atoms that the domain has.
+template <int Words>
+State<Words> from_worldstate( const worldstate_t& ws )
+{
+	static_assert( Words <= GOAP_WORDS, "The domain has more atoms than a world state built with this GOAP_WORDS can hold." );
+	State<Words> s{};
+	for ( int w=0; w<Words; ++w ) s.values[ w ] = bfield_word( ws.values, w );
+	return s;
+}
+
+} // namespace gpgoap
+
+#endif
@@ -0,0 +1,301 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#include "plancache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define NUMSHARDS 16	//!< The cache is split in shards with a lock each, so that threads rarely wait for each other.
+
+
+//!< A cached plan, stored as action indices.
+typedef struct
+{
+	actionplanner_t const* ap;	//!< The planner that made the plan.
+	unsigned int version;		//!< The version of the planner when it made the plan.
+	int heuristic;			//!< The options of the search that made the plan: with other options, it can find another plan, or one of another cost.
+	float epsilon;
+	bool prune;
+	bool stubborn;
+	bfield_t start;			//!< The start state, with atoms that do not matter cleared.
+	worldstate_t goal;		//!< The goal, with atoms that do not matter cleared.
+	uint64_t hash;			//!< Hash of all of the above.
+	int cost;			//!< Total cost of the plan, or ASTAR_NOPATH.
+	int numsteps;			//!< The nr of actions in the plan.
+	uint8_t actions[ PLANCACHE_MAXSTEPS ];	//!< The actions that make up the plan.
+	int chain;			//!< Next entry in the same hash bucket, -1 for none.
+	int newer;			//!< Next more recently used entry, -1 for none.
+	int older;			//!< Next less recently used entry, -1 for none.
+} cacheentry_t;
+
+
+typedef struct
+{
+	pthread_mutex_t lock;		//!< Protects everything below.
+	cacheentry_t* entries;		//!< Storage for entries.
+	int numentries;			//!< The nr of entries in use.
+	int capacity;			//!< The nr of entries in storage.
+	int* buckets;			//!< First entry for each hash bucket, -1 for none.
+	int numbuckets;			//!< The nr of buckets, a power of two.
+	int newest;			//!< The most recently used entry, -1 for none.
+	int oldest;			//!< The least recently used entry, -1 for none.
+	uint64_t hits;			//!< The nr of lookups in this shard answered from the cache.
+	uint64_t misses;		//!< The nr of lookups in this shard that needed a search.
+} shard_t;
+
+
+struct plancache
+{
+	shard_t shards[ NUMSHARDS ];	//!< The shards, selected by the top bits of the hash.
+};
+
+
+//!< Internal function to build the key for a question: start and goal with the atoms that cannot influence the plan cleared, and the search options.
+static void make_key( const astarcontext_t* ctx, actionplanner_t const* ap, worldstate_t start, worldstate_t goal, cacheentry_t* key )
+{
+	const actiontable_t* table = &ap->act_table;
+	key->ap = ap;
+	key->version = ap->version;
+	key->heuristic = ctx->heuristic;
+	key->epsilon = ctx->epsilon;
+	key->prune = ctx->prune;
+	key->stubborn = ctx->stubborn;
+	key->goal.dontcare = goal.dontcare;
+	key->start = bfield_zero();
+	key->goal.values = bfield_zero();
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		const uint64_t goalcare = ~bfield_word( goal.dontcare, w );
+		uint64_t relevant = goalcare;
+		for ( int a=0; a<table->numactions; ++a )
+			relevant |= table->pre_care[ w ][ a ];
+		bfield_setword( &key->start, w, bfield_word( start.values, w ) & relevant );
+		bfield_setword( &key->goal.values, w, bfield_word( goal.values, w ) & goalcare );
+	}
+	uint64_t h = bfield_hash( key->start );
+	h ^= bfield_hash( key->goal.values ) * 0x9e3779b97f4a7c15ULL;
+	h ^= bfield_hash( key->goal.dontcare ) * 0xc2b2ae3d27d4eb4fULL;
+	h ^= ( (uint64_t)(uintptr_t)ap ^ ( (uint64_t)key->version << 32 ) ) * 0x165667b19e3779f9ULL;
+	h ^= ( (uint64_t)key->heuristic << 2 | (uint64_t)key->prune << 1 | (uint64_t)key->stubborn ) * 0x27d4eb2f165667c5ULL;
+	h ^= (uint64_t)( key->epsilon * 1024.0f ) * 0x85ebca77c2b2ae63ULL;
+	key->hash = h;
+}
+
+
+static bool same_key( const cacheentry_t* a, const cacheentry_t* b )
+{
+	return a->hash == b->hash && a->ap == b->ap && a->version == b->version &&
+		a->heuristic == b->heuristic && a->epsilon == b->epsilon && a->prune == b->prune && a->stubborn == b->stubborn &&
+		bfield_equal( a->start, b->start ) &&
+		bfield_equal( a->goal.values, b->goal.values ) &&
+		bfield_equal( a->goal.dontcare, b->goal.dontcare );
+}
+
+
+static shard_t* shard_for( plancache_t* cache, uint64_t hash )
+{
+	return cache->shards + ( hash >> 60 ) % NUMSHARDS;
+}
+
+
+//!< Internal function to take an entry out of the recently-used list.
+static void unlink_lru( shard_t* shard, int e )
+{
+	cacheentry_t* entry = shard->entries + e;
+	if ( entry->newer >= 0 ) shard->entries[ entry->newer ].older = entry->older; else shard->newest = entry->older;
+	if ( entry->older >= 0 ) shard->entries[ entry->older ].newer = entry->newer; else shard->oldest = entry->newer;
+}
+
+
+//!< Internal function to put an entry at the front of the recently-used list.
+static void link_newest( shard_t* shard, int e )
+{
+	cacheentry_t* entry = shard->entries + e;
+	entry->newer = -1;
+	entry->older = shard->newest;
+	if ( shard->newest >= 0 ) shard->entries[ shard->newest ].newer = e; else shard->oldest = e;
+	shard->newest = e;
+}
+
+
+//!< Internal function to find an entry in a shard. Returns -1 if it is not there.
+static int find_entry( shard_t* shard, const cacheentry_t* key )
+{
+	for ( int e = shard->buckets[ key->hash & ( shard->numbuckets - 1 ) ]; e >= 0; e = shard->entries[ e ].chain )
+		if ( same_key( shard->entries + e, key ) ) return e;
+	return -1;
+}
+
+
+//!< Internal function to store an entry in a shard, evicting the least recently used entry if the shard is full.
+static void store_entry( shard_t* shard, const cacheentry_t* entry )
+{
+	int e = find_entry( shard, entry );
+	if ( e >= 0 )
+	{
+		unlink_lru( shard, e );
+	}
+	else
+	{
+		if ( shard->numentries < shard->capacity )
+		{
+			e = shard->numentries++;
+		}
+		else
+		{
+			e = shard->oldest;
+			unlink_lru( shard, e );
+			int* link = shard->buckets + ( shard->entries[ e ].hash & ( shard->numbuckets - 1 ) );
+			while ( *link != e ) link = &shard->entries[ *link ].chain;
+			*link = shard->entries[ e ].chain;
+		}
+		int* bucket = shard->buckets + ( entry->hash & ( shard->numbuckets - 1 ) );
+		shard->entries[ e ] = *entry;
+		shard->entries[ e ].chain = *bucket;
+		*bucket = e;
+	}
+	link_newest( shard, e );
+}
+
+
+//!< Internal function to hand out a cached plan, replaying its actions from the actual start to get the world states.
+static void replay_plan( actionplanner_t const* ap, worldstate_t start, const cacheentry_t* entry, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	// Like reconstruct_plan(), return the tail of the plan if it does not fit.
+	const int skip = entry->numsteps > *plansize ? entry->numsteps - *plansize : 0;
+	worldstate_t ws = start;
+	for ( int i=0; i<entry->numsteps; ++i )
+	{
+		ws = goap_apply_action( &ap->act_table, entry->actions[ i ], ws );
+		if ( i >= skip )
+		{
+			plan[ i - skip ] = ap->act_names[ entry->actions[ i ] ];
+			worldstates[ i - skip ] = ws;
+		}
+	}
+	if ( skip )
+		LOGE( "Plan of size %d cannot be returned in buffer of size %d", entry->numsteps, *plansize );
+	*plansize = entry->numsteps;
+}
+
+
+plancache_t* plancache_create( int capacity )
+{
+	plancache_t* cache = (plancache_t*) calloc( 1, sizeof( plancache_t ) );
+	if ( !cache ) return 0;
+	const int pershard = capacity > NUMSHARDS ? ( capacity + NUMSHARDS - 1 ) / NUMSHARDS : 1;
+	int numbuckets = 1;
+	while ( numbuckets < pershard ) numbuckets *= 2;
+	bool ok = true;
+	for ( int i=0; i<NUMSHARDS; ++i )
+	{
+		shard_t* shard = cache->shards + i;
+		pthread_mutex_init( &shard->lock, 0 );
+		shard->capacity = pershard;
+		shard->numbuckets = numbuckets;
+		shard->newest = shard->oldest = -1;
+		shard->entries = (cacheentry_t*) malloc( pershard * sizeof( cacheentry_t ) );
+		shard->buckets = (int*) malloc( numbuckets * sizeof( int ) );
+		if ( shard->buckets ) memset( shard->buckets, 0xff, numbuckets * sizeof( int ) );
+		ok = ok && shard->entries && shard->buckets;
+	}
+	if ( !ok )
+	{
+		plancache_destroy( cache );
+		return 0;
+	}
+	return cache;
+}
+
+
+void plancache_destroy( plancache_t* cache )
+{
+	for ( int i=0; i<NUMSHARDS; ++i )
+	{
+		shard_t* shard = cache->shards + i;
+		pthread_mutex_destroy( &shard->lock );
+		free( shard->entries );
+		free( shard->buckets );
+	}
+	free( cache );
+}
+
+
+void plancache_stats( const plancache_t* cache, uint64_t* hits, uint64_t* misses )
+{
+	uint64_t numhits = 0;
+	uint64_t nummisses = 0;
+	for ( int i=0; i<NUMSHARDS; ++i )
+	{
+		// the counts are kept under the lock of their shard, which the lookups take anyway.
+		pthread_mutex_t* lock = (pthread_mutex_t*) &cache->shards[ i ].lock;
+		pthread_mutex_lock( lock );
+		numhits += cache->shards[ i ].hits;
+		nummisses += cache->shards[ i ].misses;
+		pthread_mutex_unlock( lock );
+	}
+	if ( hits ) *hits = numhits;
+	if ( misses ) *misses = nummisses;
+}
+
+
+int astar_plan_cached
+(
+	plancache_t* cache,
+	astarcontext_t* ctx,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	cacheentry_t entry;
+	make_key( ctx, ap, start, goal, &entry );
+	shard_t* shard = shard_for( cache, entry.hash );
+
+	pthread_mutex_lock( &shard->lock );
+	const int e = find_entry( shard, &entry );
+	if ( e >= 0 )
+	{
+		unlink_lru( shard, e );
+		link_newest( shard, e );
+		entry = shard->entries[ e ];
+		shard->hits++;
+	}
+	else
+		shard->misses++;
+	pthread_mutex_unlock( &shard->lock );
+
+	if ( e >= 0 )
+	{
+		replay_plan( ap, start, &entry, plan, worldstates, plansize );
+		return entry.cost;
+	}
+
+	const int bufsize = *plansize;
+	entry.cost = astar_plan_ctx( ctx, ap, start, goal, plan, worldstates, plansize );
+	entry.numsteps = entry.cost >= 0 ? *plansize : 0;
+	if ( entry.cost == ASTAR_OVERBUDGET || entry.numsteps > bufsize || entry.numsteps > PLANCACHE_MAXSTEPS )
+		return entry.cost;	// we do not have the whole plan, or it may succeed with a bigger budget.
+	// take the actions from the nodes of the search, from the goal back to the start.
+	int step = entry.numsteps;
+	for ( int i=ctx->goalidx; entry.cost >= 0 && ctx->nodeaction[ i ] >= 0; i=ctx->nodeparent[ i ] )
+		entry.actions[ --step ] = (uint8_t) ctx->nodeaction[ i ];
+
+	pthread_mutex_lock( &shard->lock );
+	store_entry( shard, &entry );
+	pthread_mutex_unlock( &shard->lock );
+	return entry.cost;
+}
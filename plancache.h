@@ -0,0 +1,58 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#ifndef PLANCACHE_H
+#define PLANCACHE_H
+
+#include "goap.h"
+#include "astar.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#define PLANCACHE_MAXSTEPS 32	//!< Longer plans are not cached.
+
+//!< A cache of plans, keyed on planner, planner version, start and goal. Safe to share between threads.
+typedef struct plancache plancache_t;
+
+
+//! Create a cache that holds up to capacity plans. The least recently used plan makes way when it is full.
+extern plancache_t* plancache_create( int capacity );
+
+//! Free a cache.
+extern void plancache_destroy( plancache_t* cache );
+
+//! Get the nr of lookups that were answered from the cache, and the nr of lookups that needed a search.
+extern void plancache_stats( const plancache_t* cache, uint64_t* hits, uint64_t* misses );
+
+//! Same as astar_plan_ctx(), but returns a cached plan if the same question was asked before.
+//! The question is the same if it is asked of the same planner, at the same version (see actionplanner_t::version),
+//! with the same goal, with a start state that agrees on all atoms that action preconditions or the goal look at,
+//! and with the same heuristic, epsilon, prune and stubborn options in ctx.
+//! Searches that run out of budget are not cached.
+extern int astar_plan_cached
+(
+        plancache_t* cache,             //!< the cache to use
+        astarcontext_t* ctx,            //!< search state for when the plan is not in the cache
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
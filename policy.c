@@ -0,0 +1,234 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#include "policy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define NOPATH_ENTRY 0xffffffffu	//!< Table entry for a state from which the goal cannot be reached.
+#define NO_ACTION 0xffu			//!< Next action in the table entry of a state that satisfies the goal.
+#define MAX_COST 0xfffffe		//!< The largest cost to go that fits in a table entry.
+
+
+//!< Internal function to gather the bits of the atoms that the policy covers into a table index.
+static uint32_t gather( const astarpolicy_t* policy, bfield_t b )
+{
+	uint32_t idx = 0;
+	for ( int i=0; i<policy->numatoms; ++i )
+		idx |= (uint32_t)bfield_get( b, policy->atoms[ i ] ) << i;
+	return idx;
+}
+
+
+//!< The opened states of the backward Dijkstra search: a binary heap of cost to go (upper half) and state (lower half), lowest on top.
+//!< A state is pushed again when its cost drops, and the stale entry is skipped when it comes out.
+typedef struct
+{
+	uint64_t* items;	//!< The heap.
+	int count;		//!< The nr of items in the heap.
+	int capacity;		//!< The nr of items that storage has room for.
+} costheap_t;
+
+
+static bool heap_push( costheap_t* heap, uint64_t item )
+{
+	if ( heap->count == heap->capacity )
+	{
+		const int capacity = heap->capacity ? 2 * heap->capacity : 1024;
+		uint64_t* items = (uint64_t*) realloc( heap->items, capacity * sizeof( uint64_t ) );
+		if ( !items ) return false;
+		heap->items = items;
+		heap->capacity = capacity;
+	}
+	int pos = heap->count++;
+	while ( pos > 0 && heap->items[ ( pos - 1 ) / 2 ] > item )
+	{
+		heap->items[ pos ] = heap->items[ ( pos - 1 ) / 2 ];
+		pos = ( pos - 1 ) / 2;
+	}
+	heap->items[ pos ] = item;
+	return true;
+}
+
+
+static uint64_t heap_pop( costheap_t* heap )
+{
+	const uint64_t top = heap->items[ 0 ];
+	const uint64_t item = heap->items[ --heap->count ];
+	int pos = 0;
+	while ( true )
+	{
+		int child = 2 * pos + 1;
+		if ( child >= heap->count ) break;
+		if ( child + 1 < heap->count && heap->items[ child + 1 ] < heap->items[ child ] ) child++;
+		if ( heap->items[ child ] >= item ) break;
+		heap->items[ pos ] = heap->items[ child ];
+		pos = child;
+	}
+	heap->items[ pos ] = item;
+	return top;
+}
+
+
+bool astar_policy_compile( astarpolicy_t* policy, actionplanner_t const* ap, worldstate_t goal )
+{
+	const actiontable_t* table = &ap->act_table;
+	memset( policy, 0, sizeof( astarpolicy_t ) );
+	policy->ap = ap;
+	policy->version = ap->version;
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		bfield_setword( &goal.values, w, bfield_word( goal.values, w ) & ~bfield_word( goal.dontcare, w ) );
+	policy->goal = goal;
+
+	// the atoms that the goal or any action looks at or changes. The others keep their value, whatever the plan.
+	for ( int w=0; w<GOAP_WORDS; ++w )
+	{
+		uint64_t used = ~bfield_word( goal.dontcare, w );
+		for ( int a=0; a<table->numactions; ++a )
+			used |= table->pre_care[ w ][ a ] | table->pst_care[ w ][ a ];
+		for ( ; used; used &= used - 1 )
+		{
+			if ( policy->numatoms == ASTAR_POLICY_MAXATOMS )
+			{
+				LOGE( "Domain uses more than %d atoms, too many for a policy.", ASTAR_POLICY_MAXATOMS );
+				return false;
+			}
+			policy->atoms[ policy->numatoms++ ] = (int16_t)( 64 * w + bfield_ctz64( used ) );
+		}
+	}
+
+	// conditions and goal in terms of table indices.
+	uint32_t pre_values[ MAXACTIONS ], pre_care[ MAXACTIONS ], pst_values[ MAXACTIONS ], pst_care[ MAXACTIONS ];
+	for ( int a=0; a<table->numactions; ++a )
+	{
+		pre_values[ a ] = gather( policy, ap->act_pre[ a ].values ) & ~gather( policy, ap->act_pre[ a ].dontcare );
+		pre_care[ a ] = ~gather( policy, ap->act_pre[ a ].dontcare );
+		pst_values[ a ] = gather( policy, ap->act_pst[ a ].values ) & ~gather( policy, ap->act_pst[ a ].dontcare );
+		pst_care[ a ] = ~gather( policy, ap->act_pst[ a ].dontcare );
+	}
+	const uint32_t numstates = 1u << policy->numatoms;
+	const uint32_t goal_care = ~gather( policy, goal.dontcare ) & ( numstates - 1 );
+	const uint32_t goal_values = gather( policy, goal.values );
+
+	uint32_t* entries = (uint32_t*) malloc( numstates * sizeof( uint32_t ) );
+	costheap_t heap = { 0, 0, 0 };
+	bool ok = entries != 0;
+	if ( ok )
+	{
+		// all states that satisfy the goal are sources, at cost 0.
+		for ( uint32_t s=0; s<numstates; ++s )
+		{
+			const bool atgoal = ( s & goal_care ) == goal_values;
+			entries[ s ] = atgoal ? NO_ACTION : NOPATH_ENTRY;
+			if ( atgoal ) ok = ok && heap_push( &heap, s );
+		}
+	}
+	while ( ok && heap.count )
+	{
+		const uint64_t item = heap_pop( &heap );
+		const uint32_t t = (uint32_t)item;
+		const uint32_t cost = (uint32_t)( item >> 32 );
+		if ( cost != entries[ t ] >> 8 ) continue;	// stale: the state was reached more cheaply since.
+		// the states from which an action leads to t: they meet its preconditions, and its effects are those of t.
+		for ( int a=0; a<table->numactions; ++a )
+		{
+			if ( ( t & pst_care[ a ] ) != pst_values[ a ] ) continue;
+			const uint32_t kept = pre_care[ a ] & ~pst_care[ a ];
+			if ( ( t & kept ) != ( pre_values[ a ] & kept ) ) continue;
+			// atoms that the action changes without requiring them can have had either value before.
+			const uint32_t base = ( t & ~pst_care[ a ] ) | ( pre_values[ a ] & pst_care[ a ] );
+			const uint32_t either = pst_care[ a ] & ~pre_care[ a ] & ( numstates - 1 );
+			const uint32_t newcost = cost + (uint32_t)ap->act_costs[ a ];
+			if ( newcost > MAX_COST ) { LOGE( "Cost to go does not fit in a policy." ); ok = false; break; }
+			uint32_t sub = 0;
+			do
+			{
+				const uint32_t s = base | sub;
+				// only a strictly cheaper cost changes the next action, so that following the table always leads to states found earlier, and ends.
+				if ( newcost < entries[ s ] >> 8 )
+				{
+					entries[ s ] = ( newcost << 8 ) | (uint32_t)a;
+					ok = ok && heap_push( &heap, ( (uint64_t)newcost << 32 ) | s );
+				}
+				sub = ( sub - either ) & either;
+			} while ( sub );
+		}
+	}
+	free( heap.items );
+	if ( !ok )
+	{
+		free( entries );
+		return false;
+	}
+	policy->entries = entries;
+	return true;
+}
+
+
+void astar_policy_release( astarpolicy_t* policy )
+{
+	free( policy->entries );
+	policy->entries = 0;
+}
+
+
+int astar_policy_next( const astarpolicy_t* policy, worldstate_t ws, int* action )
+{
+	const uint32_t entry = policy->entries[ gather( policy, ws.values ) ];
+	if ( entry == NOPATH_ENTRY ) { *action = -1; return ASTAR_NOPATH; }
+	*action = ( entry & 0xff ) == NO_ACTION ? -1 : (int)( entry & 0xff );
+	return (int)( entry >> 8 );
+}
+
+
+int astar_plan_policy
+(
+	const astarpolicy_t* policy,
+	worldstate_t start,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	actionplanner_t const* ap = policy->ap;
+	if ( policy->version != ap->version ) { LOGE( "Policy was compiled for an older version of the planner." ); return ASTAR_NOPATH; }
+	int action;
+	const int cost = astar_policy_next( policy, start, &action );
+	if ( cost < 0 ) { LOGI( "Did not find a path." ); return cost; }
+
+	// count the steps first, so that we know which tail of the plan to return if it does not fit.
+	int numsteps = 0;
+	for ( worldstate_t ws=start; action >= 0; ++numsteps )
+	{
+		ws = goap_apply_action( &ap->act_table, action, ws );
+		astar_policy_next( policy, ws, &action );
+	}
+	const int skip = numsteps > *plansize ? numsteps - *plansize : 0;
+
+	astar_policy_next( policy, start, &action );
+	worldstate_t ws = start;
+	for ( int step=0; action >= 0; ++step )
+	{
+		ws = goap_apply_action( &ap->act_table, action, ws );
+		if ( step >= skip )
+		{
+			plan[ step - skip ] = ap->act_names[ action ];
+			worldstates[ step - skip ] = ws;
+		}
+		astar_policy_next( policy, ws, &action );
+	}
+	if ( skip )
+		LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+
+	*plansize = numsteps;
+	return cost;
+}
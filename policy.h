@@ -0,0 +1,62 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "goap.h"
+#include "astar.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+#define ASTAR_POLICY_MAXATOMS 24	//!< Domains that use more atoms cannot be compiled into a policy: the table would take more than 64MB.
+
+//!< The best next action towards one goal, for every state of a small domain. Made by astar_policy_compile(), so that planning becomes a table lookup.
+//!< The table covers only the atoms that the goal or an action looks at or changes, as the other atoms never change and do not matter.
+typedef struct
+{
+	actionplanner_t const* ap;	//!< The planner that was compiled.
+	unsigned int version;		//!< The version of that planner.
+	worldstate_t goal;		//!< The goal, with the values of atoms that do not matter cleared.
+	int numatoms;			//!< The nr of atoms that the table covers.
+	int16_t atoms[ ASTAR_POLICY_MAXATOMS ];	//!< The atom for each bit of a table index.
+	uint32_t* entries;		//!< Per state: the cost to go in the upper 24 bits, the next action in the lower 8 bits (0xff at the goal). All bits set if the goal cannot be reached.
+} astarpolicy_t;
+
+
+//! Compile the policy for reaching the goal with the planner's actions, by a Dijkstra search backwards from all states that satisfy the goal.
+//! Returns false if the domain uses more than ASTAR_POLICY_MAXATOMS atoms, if a cost to go does not fit in 24 bits, or if out of memory.
+//! Compile again after the actions of the planner change.
+extern bool astar_policy_compile( astarpolicy_t* policy, actionplanner_t const* ap, worldstate_t goal );
+
+//! Free the table of a policy.
+extern void astar_policy_release( astarpolicy_t* policy );
+
+//! Look up the state: returns the cost of the cheapest plan to the goal, or ASTAR_NOPATH, and sets action to the first action of that plan, -1 if the state satisfies the goal.
+extern int astar_policy_next( const astarpolicy_t* policy, worldstate_t ws, int* action );
+
+//! Same as astar_plan(), but follows the table of the policy instead of searching. Returns ASTAR_NOPATH if the planner changed since the policy was compiled.
+extern int astar_plan_policy
+(
+        const astarpolicy_t* policy,    //!< the policy, which names the planner and the goal
+        worldstate_t start, 		//!< the current world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,534 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+#include "replan.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define INF 0x3fffffff	//!< Cost of a subgoal from which we know no way to the goal.
+
+
+//!< Internal function to clear the values of atoms that do not matter, so that equal partial states compare equal.
+static worldstate_t normalized( worldstate_t ws )
+{
+	for ( int w=0; w<GOAP_WORDS; ++w )
+		bfield_setword( &ws.values, w, bfield_word( ws.values, w ) & ~bfield_word( ws.dontcare, w ) );
+	return ws;
+}
+
+
+static bool same_ws( worldstate_t a, worldstate_t b )
+{
+	return bfield_equal( a.values, b.values ) && bfield_equal( a.dontcare, b.dontcare );
+}
+
+
+//!< Internal function to compare the action tables that a graph was built with. Only costs may change without a rebuild.
+static bool same_table( const actiontable_t* a, const actiontable_t* b )
+{
+	return a->numactions == b->numactions && !memcmp( a, b, offsetof( actiontable_t, numactions ) );
+}
+
+
+//!< Internal function to find the index slot for a subgoal. The slot holds the subgoal, or is empty (-1) if we have no such subgoal yet.
+static int* slot_in_vertexhash( replansession_t* s, worldstate_t ws )
+{
+	const uint64_t mask = s->hashSize - 1;
+	uint64_t h = ( bfield_hash( ws.values ) ^ bfield_hash( ws.dontcare ) * 0x9e3779b97f4a7c15ULL ) & mask;
+	while ( true )
+	{
+		int* slot = s->vertexhash + h;
+		if ( *slot == -1 || same_ws( s->vertices[ *slot ].ws, ws ) ) return slot;
+		h = ( h + 1 ) & mask;
+	}
+}
+
+
+//!< Internal function to compute how many bytes a graph of the given size needs.
+static size_t storage_size( int maxvertices, int maxedges, int hashsize )
+{
+	return (size_t)maxvertices * ( sizeof( replanvertex_t ) + 4 * sizeof( int ) ) + (size_t)maxedges * sizeof( replanedge_t ) + (size_t)hashsize * sizeof( int );
+}
+
+
+//!< Internal function to make sure there is room for one more subgoal, within the budget. Returns false if the budget does not allow it.
+static bool reserve_vertex( replansession_t* s )
+{
+	if ( s->numVertices < s->maxVertices ) return true;
+	const int maxvertices = s->maxVertices ? 2 * s->maxVertices : ASTAR_CHUNK;
+	const int hashsize = 2 * maxvertices;
+	const size_t budget = s->budget ? s->budget : ASTAR_DEFAULT_BUDGET;
+	if ( storage_size( maxvertices, s->maxEdges, hashsize ) > budget ) return false;
+
+	replanvertex_t* vertices = (replanvertex_t*) realloc( s->vertices, maxvertices * sizeof( replanvertex_t ) );
+	if ( !vertices ) return false;
+	s->vertices = vertices;
+	int* queue = (int*) realloc( s->queue, maxvertices * sizeof( int ) );
+	if ( !queue ) return false;
+	s->queue = queue;
+	int* matching = (int*) realloc( s->matching, maxvertices * sizeof( int ) );
+	if ( !matching ) return false;
+	s->matching = matching;
+	int* trail = (int*) realloc( s->trail, 2 * maxvertices * sizeof( int ) );
+	if ( !trail ) return false;
+	s->trail = trail;
+	int* vertexhash = (int*) realloc( s->vertexhash, hashsize * sizeof( int ) );
+	if ( !vertexhash ) return false;
+	s->vertexhash = vertexhash;
+	s->hashSize = hashsize;
+	memset( s->vertexhash, 0xff, hashsize * sizeof( int ) );
+	for ( int i=0; i<s->numVertices; ++i )
+		*slot_in_vertexhash( s, s->vertices[ i ].ws ) = i;
+	s->maxVertices = maxvertices;
+	return true;
+}
+
+
+//!< Internal function to make sure there is room for one more edge, within the budget. Returns false if the budget does not allow it.
+static bool reserve_edge( replansession_t* s )
+{
+	if ( s->numEdges < s->maxEdges ) return true;
+	const int maxedges = s->maxEdges ? 2 * s->maxEdges : ASTAR_CHUNK;
+	const size_t budget = s->budget ? s->budget : ASTAR_DEFAULT_BUDGET;
+	if ( storage_size( s->maxVertices, maxedges, s->hashSize ) > budget ) return false;
+	replanedge_t* edges = (replanedge_t*) realloc( s->edges, maxedges * sizeof( replanedge_t ) );
+	if ( !edges ) return false;
+	s->edges = edges;
+	s->maxEdges = maxedges;
+	return true;
+}
+
+
+//!< Internal function to empty the graph.
+static void clear_graph( replansession_t* s )
+{
+	// Remove from the index in reverse order of addition, like clear_nodes() in astar.c.
+	for ( int i=s->numVertices-1; i>=0; --i )
+		*slot_in_vertexhash( s, s->vertices[ i ].ws ) = -1;
+	s->numVertices = 0;
+	s->numEdges = 0;
+	s->numQueued = 0;
+	s->numMatching = 0;
+}
+
+
+//!< This is our heuristic: the cost from the start to a subgoal is at least the cheapest action cost, for every so many atoms that one action can change.
+//!< Unlike the mismatch count of astar.c, this never overestimates, which keeps the repaired plans optimal.
+static int calc_h( const replansession_t* s, worldstate_t ws )
+{
+	if ( !s->maxeffects ) return 0;
+	const int mismatch = bfield_mismatch( s->start.values, ws.values, ws.dontcare );
+	return ( mismatch + s->maxeffects - 1 ) / s->maxeffects * s->mincost;
+}
+
+
+static void calc_key( const replansession_t* s, const replanvertex_t* vx, int* key1, int* key2 )
+{
+	const int m = vx->g < vx->rhs ? vx->g : vx->rhs;
+	*key1 = m >= INF ? INF : m + calc_h( s, vx->ws ) + s->km;
+	*key2 = m;
+}
+
+
+static bool key_lower( int a1, int a2, int b1, int b2 )
+{
+	return a1 < b1 || ( a1 == b1 && a2 < b2 );
+}
+
+
+static bool ranks_lower( const replanvertex_t* a, const replanvertex_t* b )
+{
+	return key_lower( a->key1, a->key2, b->key1, b->key2 );
+}
+
+
+//!< Internal function to move a queued subgoal up the heap, after it was added or its key decreased.
+static void heap_up( replansession_t* s, int pos )
+{
+	replanvertex_t* vertices = s->vertices;
+	const int v = s->queue[ pos ];
+	while ( pos > 0 )
+	{
+		const int parent = ( pos - 1 ) / 2;
+		const int parentv = s->queue[ parent ];
+		if ( !ranks_lower( vertices+v, vertices+parentv ) ) break;
+		s->queue[ pos ] = parentv;
+		vertices[ parentv ].heapidx = pos;
+		pos = parent;
+	}
+	s->queue[ pos ] = v;
+	vertices[ v ].heapidx = pos;
+}
+
+
+//!< Internal function to move a queued subgoal down the heap, after its key increased.
+static void heap_down( replansession_t* s, int pos )
+{
+	replanvertex_t* vertices = s->vertices;
+	const int v = s->queue[ pos ];
+	while ( true )
+	{
+		int child = 2 * pos + 1;
+		if ( child >= s->numQueued ) break;
+		if ( child+1 < s->numQueued && ranks_lower( vertices+s->queue[ child+1 ], vertices+s->queue[ child ] ) ) child++;
+		const int childv = s->queue[ child ];
+		if ( !ranks_lower( vertices+childv, vertices+v ) ) break;
+		s->queue[ pos ] = childv;
+		vertices[ childv ].heapidx = pos;
+		pos = child;
+	}
+	s->queue[ pos ] = v;
+	vertices[ v ].heapidx = pos;
+}
+
+
+//!< Internal function to take a subgoal out of the queue, wherever it is.
+static void heap_remove( replansession_t* s, int pos )
+{
+	s->vertices[ s->queue[ pos ] ].heapidx = -1;
+	if ( --s->numQueued == pos ) return;
+	const int moved = s->queue[ s->numQueued ];
+	s->queue[ pos ] = moved;
+	heap_up( s, pos );
+	heap_down( s, s->vertices[ moved ].heapidx );
+}
+
+
+//!< Internal function to recompute the one-step lookahead cost of a subgoal, and (de)queue it depending on whether it needs expanding.
+static void update_vertex( replansession_t* s, int v )
+{
+	replanvertex_t* vx = s->vertices + v;
+	if ( v != 0 )	// the goal itself costs nothing.
+	{
+		int rhs = INF;
+		for ( int e=vx->firstout; e>=0; e=s->edges[ e ].nextout )
+		{
+			const replanedge_t* edge = s->edges + e;
+			const int g = s->vertices[ edge->to ].g;
+			if ( g < INF && g + s->costs[ edge->action ] < rhs ) rhs = g + s->costs[ edge->action ];
+		}
+		vx->rhs = rhs;
+	}
+	if ( vx->g != vx->rhs )
+	{
+		calc_key( s, vx, &vx->key1, &vx->key2 );
+		if ( vx->heapidx >= 0 )
+		{
+			heap_up( s, vx->heapidx );
+			heap_down( s, vx->heapidx );
+		}
+		else
+		{
+			s->queue[ s->numQueued ] = v;
+			heap_up( s, s->numQueued++ );
+		}
+	}
+	else if ( vx->heapidx >= 0 )
+	{
+		heap_remove( s, vx->heapidx );
+	}
+}
+
+
+//!< Internal function to recompute the cost from the start, after the cost of a subgoal that the start satisfies went up.
+static void update_start( replansession_t* s )
+{
+	int rhs = INF;
+	for ( int i=0; i<s->numMatching; ++i )
+	{
+		const int g = s->vertices[ s->matching[ i ] ].g;
+		if ( g < rhs ) rhs = g;
+	}
+	s->startrhs = rhs;
+}
+
+
+//!< Internal function to find the subgoal for a partial state, adding it if we have none. Returns -1 if the budget does not allow it.
+static int find_or_add_vertex( replansession_t* s, worldstate_t ws )
+{
+	// storage may move when it grows, so make room before we hold on to a slot.
+	if ( !reserve_vertex( s ) ) return -1;
+	int* slot = slot_in_vertexhash( s, ws );
+	if ( *slot >= 0 ) return *slot;
+	const int v = s->numVertices++;
+	*slot = v;
+	replanvertex_t* vx = s->vertices + v;
+	vx->ws = ws;
+	vx->g = INF;
+	vx->rhs = INF;
+	vx->key1 = vx->key2 = INF;
+	vx->heapidx = -1;
+	vx->firstout = -1;
+	vx->firstin = -1;
+	vx->expanded = false;
+	if ( bfield_match( s->start.values, ws.values, ws.dontcare ) )
+		s->matching[ s->numMatching++ ] = v;
+	return v;
+}
+
+
+//!< Internal function to generate the subgoals from which a single action reaches subgoal v. Returns false if the budget does not allow it.
+static bool generate_predecessors( replansession_t* s, int v )
+{
+	for ( int a=0; a<s->table.numactions; ++a )
+	{
+		worldstate_t pre;
+		if ( !goap_regress_action( &s->table, a, s->vertices[ v ].ws, &pre ) ) continue;
+		const int p = find_or_add_vertex( s, pre );
+		if ( p < 0 || !reserve_edge( s ) ) return false;
+		replanedge_t* edge = s->edges + s->numEdges;
+		edge->from = p;
+		edge->to = v;
+		edge->action = a;
+		edge->nextout = s->vertices[ p ].firstout;
+		edge->nextin = s->vertices[ v ].firstin;
+		s->vertices[ p ].firstout = s->numEdges;
+		s->vertices[ v ].firstin = s->numEdges;
+		s->numEdges++;
+	}
+	s->vertices[ v ].expanded = true;
+	return true;
+}
+
+
+//!< Internal function to expand subgoals until the cost from the start is known. Returns false if the budget does not allow it.
+static bool compute_costs( replansession_t* s )
+{
+	while ( s->numQueued > 0 )
+	{
+		const int v = s->queue[ 0 ];
+		replanvertex_t* vx = s->vertices + v;
+		// Ties must be expanded too: a subgoal that the start satisfies has the same key as the start itself.
+		const int startkey1 = s->startrhs >= INF ? INF : s->startrhs + s->km;
+		if ( key_lower( startkey1, s->startrhs, vx->key1, vx->key2 ) ) break;
+		int key1, key2;
+		calc_key( s, vx, &key1, &key2 );
+		if ( key_lower( vx->key1, vx->key2, key1, key2 ) )
+		{
+			// queued before the start moved: requeue with its current key.
+			vx->key1 = key1;
+			vx->key2 = key2;
+			heap_down( s, 0 );
+			continue;
+		}
+		s->numExpanded++;
+		if ( !vx->expanded && !generate_predecessors( s, v ) ) return false;
+		vx = s->vertices + v;	// storage may have moved.
+		const bool matches = bfield_match( s->start.values, vx->ws.values, vx->ws.dontcare );
+		if ( vx->g > vx->rhs )
+		{
+			// cheaper than we thought: settle it.
+			vx->g = vx->rhs;
+			heap_remove( s, 0 );
+			for ( int e=vx->firstin; e>=0; e=s->edges[ e ].nextin )
+				update_vertex( s, s->edges[ e ].from );
+			if ( matches && vx->g < s->startrhs ) s->startrhs = vx->g;
+		}
+		else
+		{
+			// more expensive than we thought: forget its cost, and let it and all that depend on it find a new one.
+			vx->g = INF;
+			update_vertex( s, v );
+			for ( int e=vx->firstin; e>=0; e=s->edges[ e ].nextin )
+				update_vertex( s, s->edges[ e ].from );
+			if ( matches ) update_start( s );
+		}
+	}
+	return true;
+}
+
+
+//!< Internal function to start a new graph that leads to the specified goal.
+static bool reset_graph( replansession_t* s, actionplanner_t const* ap, worldstate_t goal )
+{
+	clear_graph( s );
+	s->ap = ap;
+	s->version = ap->version;
+	s->table = ap->act_table;
+	memcpy( s->costs, ap->act_costs, sizeof( s->costs ) );
+	s->goal = goal;
+	s->km = 0;
+	s->startrhs = INF;
+	s->maxeffects = 0;
+	s->mincost = INF;
+	for ( int a=0; a<ap->numactions; ++a )
+	{
+		int numeffects = 0;
+		for ( int w=0; w<GOAP_WORDS; ++w ) numeffects += bfield_popcount64( ap->act_table.pst_care[ w ][ a ] );
+		if ( numeffects > s->maxeffects ) s->maxeffects = numeffects;
+		if ( ap->act_costs[ a ] < s->mincost ) s->mincost = ap->act_costs[ a ];
+	}
+	if ( s->mincost < 0 || s->mincost == INF ) s->mincost = 0;
+	if ( find_or_add_vertex( s, goal ) < 0 ) return false;
+	s->vertices[ 0 ].rhs = 0;
+	update_vertex( s, 0 );
+	return true;
+}
+
+
+//!< Internal function to bring the graph up to date with changed action costs. Returns false if the graph needs a rebuild instead.
+static bool update_costs( replansession_t* s, actionplanner_t const* ap )
+{
+	if ( !same_table( &s->table, &ap->act_table ) ) return false;
+	uint64_t changed = 0;
+	for ( int a=0; a<ap->numactions; ++a )
+	{
+		if ( ap->act_costs[ a ] == s->costs[ a ] ) continue;
+		if ( ap->act_costs[ a ] < s->mincost ) return false;	// our heuristic could overestimate.
+		// subgoals joined by free actions can keep each other's old cost when a cost goes up, as each one still looks one step
+		// ahead to the other. Only a graph without free actions can be repaired after an increase. (mincost is never above a cost in the graph.)
+		if ( ap->act_costs[ a ] > s->costs[ a ] && s->mincost == 0 ) return false;
+		s->costs[ a ] = ap->act_costs[ a ];
+		changed |= 1ULL << a;
+	}
+	if ( changed )
+		for ( int e=0; e<s->numEdges; ++e )
+			if ( ( changed >> s->edges[ e ].action ) & 1 )
+				update_vertex( s, s->edges[ e ].from );
+	s->version = ap->version;
+	return true;
+}
+
+
+//!< Internal function to find the path through the graph from subgoal first to the goal, in the fewest steps, over edges that keep to the cost
+//!< of the subgoal they leave. Simply following the cheapest edge can go round in circles when actions cost nothing, as a circle of such edges
+//!< costs the same as the way out. Returns the nr of steps, with their edges in reverse order in the second half of the trail, or -1 if there is no path.
+static int find_path( replansession_t* s, int first )
+{
+	int* reached = s->trail;			// per subgoal, the edge by which it was reached, -1 for first, -2 if not reached yet.
+	int* fifo = s->trail + s->maxVertices;
+	for ( int v=0; v<s->numVertices; ++v )
+		reached[ v ] = -2;
+	reached[ first ] = -1;
+	int head = 0;
+	int tail = 0;
+	fifo[ tail++ ] = first;
+	while ( head < tail && reached[ 0 ] == -2 )
+	{
+		const int v = fifo[ head++ ];
+		const int g = s->vertices[ v ].g;
+		for ( int e=s->vertices[ v ].firstout; e>=0; e=s->edges[ e ].nextout )
+		{
+			const replanedge_t* edge = s->edges + e;
+			const int tg = s->vertices[ edge->to ].g;
+			if ( reached[ edge->to ] != -2 || tg >= INF || tg + s->costs[ edge->action ] > g ) continue;
+			reached[ edge->to ] = e;
+			fifo[ tail++ ] = edge->to;
+		}
+	}
+	if ( reached[ 0 ] == -2 ) return -1;
+	int numsteps = 0;
+	for ( int v=0; v!=first; v=s->edges[ reached[ v ] ].from )
+		fifo[ numsteps++ ] = reached[ v ];
+	return numsteps;
+}
+
+
+//!< Internal function to walk the graph from the start to the goal, and return the actions taken and the world states they lead to.
+//!< Returns false if the costs in the graph do not lead to the goal, which means that they were not repaired right.
+static bool extract_plan( replansession_t* s, actionplanner_t const* ap, worldstate_t start, const char** plan, worldstate_t* worldstates, int* plansize )
+{
+	int first = -1;
+	for ( int i=0; i<s->numMatching; ++i )
+		if ( s->vertices[ s->matching[ i ] ].g == s->startrhs ) { first = s->matching[ i ]; break; }
+
+	const int numsteps = first >= 0 ? find_path( s, first ) : -1;
+	if ( numsteps < 0 ) { LOGE( "No path through the graph of cost %d.", s->startrhs ); return false; }
+	const int* path = s->trail + s->maxVertices;
+	const int skip = numsteps > *plansize ? numsteps - *plansize : 0;	// if the plan does not fit, return its tail.
+
+	worldstate_t ws = start;
+	for ( int i=0; i<numsteps; ++i )
+	{
+		const replanedge_t* edge = s->edges + path[ numsteps - 1 - i ];
+		ws = goap_apply_action( &ap->act_table, edge->action, ws );
+		if ( i >= skip )
+		{
+			plan[ i - skip ] = ap->act_names[ edge->action ];
+			worldstates[ i - skip ] = ws;
+		}
+	}
+	if ( skip )
+		LOGE( "Plan of size %d cannot be returned in buffer of size %d", numsteps, *plansize );
+	*plansize = numsteps;
+	return true;
+}
+
+
+void replan_session_init( replansession_t* session )
+{
+	memset( session, 0, sizeof( replansession_t ) );
+}
+
+
+void replan_session_release( replansession_t* session )
+{
+	free( session->vertices );
+	free( session->edges );
+	free( session->vertexhash );
+	free( session->queue );
+	free( session->matching );
+	free( session->trail );
+	const size_t budget = session->budget;
+	replan_session_init( session );
+	session->budget = budget;
+}
+
+
+int astar_plan_incremental
+(
+	replansession_t* s,
+	actionplanner_t const* ap,
+	worldstate_t start,
+	worldstate_t goal,
+	const char** plan,
+	worldstate_t* worldstates,
+	int* plansize
+)
+{
+	goal = normalized( goal );
+	s->numExpanded = 0;
+
+	bool rebuild = s->numVertices == 0 || s->ap != ap || !same_ws( s->goal, goal ) || s->km > INF / 4;
+	if ( !rebuild && s->version != ap->version )
+		rebuild = !update_costs( s, ap );
+
+	if ( rebuild )
+	{
+		s->start = start;
+		if ( !reset_graph( s, ap, goal ) ) { clear_graph( s ); LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+	}
+	else if ( !bfield_equal( s->start.values, start.values ) )
+	{
+		// The start moved. Keys queued so far were computed with the old heuristic, which is off by at most
+		// the heuristic distance between the old and new start. Adding that to all future keys keeps the old ones valid.
+		if ( s->maxeffects )
+			s->km += ( bfield_mismatch( s->start.values, start.values, bfield_zero() ) + s->maxeffects - 1 ) / s->maxeffects * s->mincost;
+		s->start = start;
+		s->numMatching = 0;
+		for ( int v=0; v<s->numVertices; ++v )
+			if ( bfield_match( start.values, s->vertices[ v ].ws.values, s->vertices[ v ].ws.dontcare ) )
+				s->matching[ s->numMatching++ ] = v;
+		update_start( s );
+	}
+
+	if ( !compute_costs( s ) ) { clear_graph( s ); LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+	if ( s->startrhs < INF && !extract_plan( s, ap, start, plan, worldstates, plansize ) )
+	{
+		// a repaired graph that does not hold up: search it again from scratch.
+		if ( !reset_graph( s, ap, goal ) || !compute_costs( s ) ) { clear_graph( s ); LOGI( "Search exceeded its memory budget." ); return ASTAR_OVERBUDGET; }
+		if ( s->startrhs < INF && !extract_plan( s, ap, start, plan, worldstates, plansize ) ) { clear_graph( s ); *plansize = 0; return ASTAR_NOPATH; }
+	}
+	if ( s->startrhs >= INF ) { LOGI( "Did not find a path." ); return ASTAR_NOPATH; }
+	return s->startrhs;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Incremental replanning, after D* Lite (Koenig and Likhachev).
+// A session searches backwards from the goal over partial world states (subgoals), and keeps that search graph between calls.
+// When the start state or the cost of an action changes, only the part of the graph that depends on it is searched again.
+
+#ifndef REPLAN_H
+#define REPLAN_H
+
+#include "goap.h"
+#include "astar.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+//!< A subgoal in the search graph: a partial world state from which the goal can be reached.
+typedef struct
+{
+	worldstate_t ws;	//!< The subgoal, with the values of atoms that do not matter cleared.
+	int g;			//!< Cost from here to the goal, as of the last time we expanded this subgoal.
+	int rhs;		//!< Cost from here to the goal, looking one step ahead. The subgoal needs expanding if this differs from g.
+	int key1;		//!< Primary rank in the queue.
+	int key2;		//!< Secondary rank in the queue, for ties.
+	int heapidx;		//!< Position in the queue, or -1 if it is not queued.
+	int firstout;		//!< First edge that leaves this subgoal towards the goal, -1 for none.
+	int firstin;		//!< First edge that arrives at this subgoal, -1 for none.
+	bool expanded;		//!< Have the subgoals that lead here been generated?
+} replanvertex_t;
+
+
+//!< An action that takes the world from one subgoal to another, one step closer to the goal.
+typedef struct
+{
+	int from;		//!< The subgoal in which the action is taken.
+	int to;			//!< The subgoal that the action achieves.
+	int action;		//!< Index of the action.
+	int nextout;		//!< Next edge that leaves the same from subgoal, -1 for none.
+	int nextin;		//!< Next edge that arrives at the same to subgoal, -1 for none.
+} replanedge_t;
+
+
+//!< A planning session that is repaired, instead of thrown away, when the start state or action costs change.
+//!< A zero-initialized session is ready for use. A session is used by one thread at a time.
+typedef struct
+{
+	replanvertex_t* vertices;	//!< Storage for all subgoals, the goal itself being the first.
+	int numVertices;		//!< The nr of subgoals in storage.
+	int maxVertices;		//!< The nr of subgoals that storage has room for.
+	replanedge_t* edges;		//!< Storage for all edges between subgoals.
+	int numEdges;			//!< The nr of edges in storage.
+	int maxEdges;			//!< The nr of edges that storage has room for.
+	int* vertexhash;		//!< Open addressing index that maps a partial world state onto its subgoal, -1 for empty slots.
+	int hashSize;			//!< The nr of slots in the index, a power of two and at least twice maxVertices.
+	int* queue;			//!< The subgoals that need expanding: a binary heap of subgoal indices, lowest key on top.
+	int numQueued;			//!< The nr of subgoals in the queue.
+	int* matching;			//!< The subgoals that the start state satisfies.
+	int numMatching;		//!< The nr of subgoals that the start state satisfies.
+	int* trail;			//!< Scratch space for finding the plan in the graph, two ints per subgoal.
+	actionplanner_t const* ap;	//!< The planner that the graph was built for.
+	unsigned int version;		//!< The version of that planner, when we last looked at it.
+	actiontable_t table;		//!< The actions that the graph was built with.
+	int costs[ MAXACTIONS ];	//!< The action costs that the graph was built with.
+	worldstate_t start;		//!< The start state of the last call.
+	worldstate_t goal;		//!< The goal that the graph leads to.
+	int startrhs;			//!< Cost from the start to the goal: the lowest cost of the subgoals that the start state satisfies.
+	int km;				//!< Key offset that keeps queued keys valid when the start state moves.
+	int maxeffects;			//!< The largest nr of atoms that a single action changes. Used by the heuristic.
+	int mincost;			//!< The lowest action cost. Used by the heuristic.
+	int numExpanded;		//!< The nr of subgoals expanded by the last call.
+	size_t budget;			//!< Max nr of bytes the graph may use, 0 for ASTAR_DEFAULT_BUDGET. When exceeded, the graph is dropped.
+} replansession_t;
+
+
+//! Initialize a planning session. Same as zero-initializing it.
+extern void replan_session_init( replansession_t* session );
+
+//! Free the graph that a session has built. The session can be used again afterwards.
+extern void replan_session_release( replansession_t* session );
+
+//! Make a plan like astar_plan(), reusing the search of the previous call on this session where possible.
+//! The graph is repaired when the start state or action costs change, and rebuilt when the goal, the planner,
+//! or action pre or postconditions change, or when a cost goes up while some action is free. Returns the optimal cost, ASTAR_NOPATH or ASTAR_OVERBUDGET.
+extern int astar_plan_incremental
+(
+        replansession_t* session,       //!< the session, reused across calls
+        actionplanner_t const* ap, 		//!< the goap action planner that holds atoms and action repertoire
+        worldstate_t start, 		//!< the current world state
+        worldstate_t goal, 		//!< the desired world state
+        const char** plan,              //!< for returning all actions that make up plan
+        worldstate_t* worldstates,      //!< for returning intermediate world states
+        int* plansize                   //!< in: size of plan buffer, out: size of plan (in nr of steps)
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+/*
+Copyright 2012 Abraham T. Stolk
+
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// Regression test for incremental replanning in domains where many actions cost nothing.
+// Between calls, the session sees action costs go up and down, to and from nothing, and the start state move by a single atom.
+// Each plan must cost the same as the one that A* finds, its actions must apply one after the other and reach the goal, and their costs must add up.
+// Repairing the graph after a small move of the start must also expand fewer subgoals than a fresh session does.
+
+#include "goap.h"	// for planner interface.
+#include "astar.h"	// for A* search over worldstate space.
+#include "replan.h"	// for incremental replanning.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define NUMDOMAINS 1000		//!< Nr of random domains to plan in.
+#define NUMTICKS 9		//!< Nr of calls per domain. Odd calls follow a change of action costs, even ones a move of the start by one atom.
+#define MAXSTEPS 16		//!< Longest plan that any of the domains needs.
+
+
+static char atomnames[ 16 ][ 8 ];
+static char actionnames[ 16 ][ 8 ];
+
+
+//!< Random nr generator (splitmix64), so that the domains are the same on all platforms.
+static int random_below( uint64_t* state, int n )
+{
+	uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+	z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+	return (int)( ( z ^ ( z >> 31 ) ) % (uint64_t)n );
+}
+
+
+//!< Checks the plan that the session returned, and reports what is wrong with it. Returns the nr of failures.
+static int check_plan( actionplanner_t const* ap, int domain, worldstate_t start, worldstate_t goal, int cost, const char** plan, const worldstate_t* worldstates, int plansize )
+{
+	if ( plansize > MAXSTEPS )
+	{
+		printf( "domain %d: plan of %d steps, where none needs more than %d.\n", domain, plansize, MAXSTEPS );
+		return 1;
+	}
+	worldstate_t ws = start;
+	int sum = 0;
+	for ( int i=0; i<plansize; ++i )
+	{
+		int a = 0;
+		while ( a < ap->numactions && ap->act_names[ a ] != plan[ i ] ) ++a;
+		if ( a == ap->numactions || !( ( goap_applicable_actions( &ap->act_table, ws.values ) >> a ) & 1 ) )
+		{
+			printf( "domain %d: step %d of the plan cannot be taken.\n", domain, i );
+			return 1;
+		}
+		ws = goap_apply_action( &ap->act_table, a, ws );
+		if ( !bfield_equal( ws.values, worldstates[ i ].values ) )
+		{
+			printf( "domain %d: step %d of the plan leads to the wrong world state.\n", domain, i );
+			return 1;
+		}
+		sum += ap->act_costs[ a ];
+	}
+	if ( sum != cost || !bfield_match( ws.values, goal.values, goal.dontcare ) )
+	{
+		printf( "domain %d: plan of %d steps costs %d instead of %d, and %s the goal.\n", domain, plansize, sum, cost, bfield_match( ws.values, goal.values, goal.dontcare ) ? "reaches" : "misses" );
+		return 1;
+	}
+	return 0;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	(void)argc; (void)argv;
+	static actionplanner_t ap;
+	astarcontext_t ctx = { 0 };
+	ctx.heuristic = ASTAR_H_MAX;
+	int failures = 0;
+	int64_t repairexpanded = 0;	// subgoals expanded by the sessions, after the start moved by one atom.
+	int64_t freshexpanded = 0;	// subgoals expanded by fresh sessions, for the same questions.
+
+	for ( int domain=0; domain<NUMDOMAINS; ++domain )
+	{
+		uint64_t seed = (uint64_t)domain;
+		goap_actionplanner_clear( &ap );
+		const int numatoms = 8 + random_below( &seed, 8 );
+		const int numactions = 6 + random_below( &seed, 10 );
+		for ( int i=0; i<numatoms; ++i )
+			snprintf( atomnames[ i ], sizeof( atomnames[ i ] ), "a%d", i );
+		for ( int a=0; a<numactions; ++a )
+		{
+			snprintf( actionnames[ a ], sizeof( actionnames[ a ] ), "x%d", a );
+			const int numpre = random_below( &seed, 3 );
+			for ( int k=0; k<numpre; ++k )
+				goap_set_pre( &ap, actionnames[ a ], atomnames[ random_below( &seed, numatoms ) ], random_below( &seed, 2 ) );
+			const int numeff = 1 + random_below( &seed, 2 );
+			for ( int k=0; k<numeff; ++k )
+				goap_set_pst( &ap, actionnames[ a ], atomnames[ random_below( &seed, numatoms ) ], random_below( &seed, 2 ) );
+			// half of the actions are free, so that the graph is full of zero cost cycles.
+			goap_set_cost( &ap, actionnames[ a ], random_below( &seed, 2 ) ? 0 : 1 + random_below( &seed, 3 ) );
+		}
+		worldstate_t goal;
+		goap_worldstate_clear( &goal );
+		for ( int k=0; k<3; ++k )
+			goap_worldstate_set( &ap, &goal, atomnames[ random_below( &seed, numatoms ) ], random_below( &seed, 2 ) );
+
+		replansession_t session;
+		replan_session_init( &session );
+		worldstate_t start;
+		goap_worldstate_clear( &start );
+		for ( int i=0; i<numatoms; ++i )
+			goap_worldstate_set( &ap, &start, atomnames[ i ], random_below( &seed, 2 ) );
+		for ( int tick=0; tick<NUMTICKS; ++tick )
+		{
+			if ( tick % 2 )
+			{
+				// raise or lower the costs of a few actions, free ones included.
+				const int numchanges = 1 + random_below( &seed, 2 );
+				for ( int k=0; k<numchanges; ++k )
+					goap_set_cost( &ap, actionnames[ random_below( &seed, numactions ) ], random_below( &seed, 5 ) );
+			}
+			else if ( tick )
+			{
+				const int atom = random_below( &seed, numatoms );
+				goap_worldstate_set( &ap, &start, atomnames[ atom ], !bfield_get( start.values, atom ) );
+			}
+
+			const char* plan[ 64 ];
+			worldstate_t worldstates[ 64 ];
+			int plansize = 64;
+			const int expected = astar_plan_ctx( &ctx, &ap, start, goal, plan, worldstates, &plansize );
+			plansize = 64;
+			const int cost = astar_plan_incremental( &session, &ap, start, goal, plan, worldstates, &plansize );
+			if ( cost != expected )
+			{
+				printf( "domain %d: replanning costs %d, A* finds %d.\n", domain, cost, expected );
+				failures++;
+			}
+			else if ( cost >= 0 )
+				failures += check_plan( &ap, domain, start, goal, cost, plan, worldstates, plansize );
+
+			if ( tick && tick % 2 == 0 )
+			{
+				replansession_t fresh;
+				replan_session_init( &fresh );
+				plansize = 64;
+				astar_plan_incremental( &fresh, &ap, start, goal, plan, worldstates, &plansize );
+				repairexpanded += session.numExpanded;
+				freshexpanded += fresh.numExpanded;
+				replan_session_release( &fresh );
+			}
+		}
+		replan_session_release( &session );
+	}
+	astar_context_release( &ctx );
+
+	printf( "%d domains, %d failures. After moving the start, repairs expanded %lld subgoals, fresh sessions %lld.\n", NUMDOMAINS, failures, (long long)repairexpanded, (long long)freshexpanded );
+	if ( repairexpanded >= freshexpanded )
+	{
+		printf( "Repairing the graph expanded no fewer subgoals than starting over.\n" );
+		failures++;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}